@@ -1,14 +1,30 @@
 // copyright MIT License Copyright (c) 2021, Albert Farrakhov
 
+#include <algorithm>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "capi.h"
 #include "catch2/catch_amalgamated.hpp"
 #include "context.h"
+#include "crawl.h"
 #include "dependency.h"
+#include "diff.h"
 #include "exceptions.h"
+#include "flat_hash.h"
+#include "graph.h"
 #include "image.h"
 #include "pe.h"
+#include "query.h"
+#include "server.h"
+#include "session.h"
 #include "traversing.h"
 #include "utils.h"
 #include "view.h"
@@ -48,6 +64,198 @@ TEST_CASE("versionless", "[image]") {
   REQUIRE(versionless == L"api-ms-onecoreuap-print-render");
 }
 
+TEST_CASE("export_ordinals", "[image]") {
+  auto& pe_meta = windep::image::pe::PeMeta::Instance();
+  REQUIRE_FALSE(pe_meta.Exports("unknown_image_name.dll"));
+  auto exports = pe_meta.Exports("kernel32.dll");
+  REQUIRE(exports);
+  REQUIRE(exports->Count() > 0);
+  auto module = ::GetModuleHandleW(L"kernel32.dll");
+  for (DWORD ordinal = exports->Base();
+       ordinal < exports->Base() + exports->Count(); ++ordinal) {
+    const auto name = exports->Name(static_cast<WORD>(ordinal));
+    if (name) {
+      REQUIRE(::GetProcAddress(module, name->c_str()) ==
+              ::GetProcAddress(module, MAKEINTRESOURCEA(ordinal)));
+    }
+  }
+}
+
+TEST_CASE("ordinal_imports", "[image]") {
+  windep::image::pe::PeImage image{"shell32.dll", true};
+  REQUIRE_NOTHROW(image.Parse());
+  for (const auto& import : image.Imports()) {
+    for (const auto& func : import->Functions()) {
+      REQUIRE_FALSE(func->Name().empty());
+    }
+  }
+}
+
+TEST_CASE("forwarders", "[image]") {
+  using windep::image::ImportKind;
+  const auto has_forwarded = [](const windep::image::Image& image) {
+    for (const auto& import : image.Imports()) {
+      if (import->HasKind(ImportKind::kForwarded)) return true;
+    }
+    return false;
+  };
+  windep::image::pe::PeImage image{"kernel32.dll", false};
+  REQUIRE_NOTHROW(image.Parse());
+  REQUIRE(has_forwarded(image));
+  windep::image::pe::PeImage no_forwarders{"kernel32.dll", false, false};
+  REQUIRE_NOTHROW(no_forwarders.Parse());
+  REQUIRE_FALSE(has_forwarded(no_forwarders));
+}
+
+TEST_CASE("export_names", "[image]") {
+  auto exports = windep::image::pe::PeMeta::Instance().Exports("kernel32.dll");
+  REQUIRE(exports);
+  REQUIRE(exports->Has("CreateFileW"));
+  REQUIRE_FALSE(exports->Has("UnknownFunctionName"));
+  REQUIRE(exports->Has("#" + std::to_string(exports->Base())));
+  REQUIRE_FALSE(exports->Has("#0"));
+}
+
+TEST_CASE("content_dedup", "[image]") {
+  windep::image::pe::PeImage original{"version.dll", false};
+  REQUIRE_NOTHROW(original.Parse());
+  const auto tmp = std::filesystem::temp_directory_path() / "windep_dedup";
+  std::vector<std::string> copies;
+  for (auto dir : {"a", "b"}) {
+    std::filesystem::create_directories(tmp / dir);
+    const auto copy = tmp / dir / "version.dll";
+    std::filesystem::copy_file(
+        original.Path(), copy,
+        std::filesystem::copy_options::overwrite_existing);
+    copies.push_back(copy.u8string());
+  }
+  windep::image::pe::PeImageFactory factory;
+  const auto first = factory.Create(copies[0]);
+  const auto second = factory.Create(copies[1]);
+  REQUIRE(first->Imports().size() > 0);
+  // Imports of the second copy are not parsed again
+  REQUIRE(*first->Imports().begin() == *second->Imports().begin());
+  std::filesystem::remove_all(tmp);
+}
+
+TEST_CASE("partial_reads", "[image]") {
+  windep::image::pe::LoadedImage image{"shell32.dll"};
+  REQUIRE(image.BytesRead() > 0);
+  REQUIRE(image.BytesRead() < std::filesystem::file_size(image.Path()) / 4);
+  // Import names are the same as in the image mapped by the loader
+  auto module = ::LoadLibraryExW(image.Path().c_str(), nullptr,
+                                 DONT_RESOLVE_DLL_REFERENCES);
+  REQUIRE(module);
+  const auto mapped = reinterpret_cast<PBYTE>(module);
+  const auto& imports = image.DataDirectory()[IMAGE_DIRECTORY_ENTRY_IMPORT];
+  REQUIRE(imports.Size);
+  for (auto descr =
+           image.Read<PIMAGE_IMPORT_DESCRIPTOR>(imports.VirtualAddress);
+       descr->OriginalFirstThunk; ++descr) {
+    REQUIRE(std::string(image.Read<PCSTR>(descr->Name)) ==
+            reinterpret_cast<PCSTR>(mapped + descr->Name));
+  }
+  ::FreeLibrary(module);
+  // Images created by the factory read as little, fingerprints included
+  windep::image::ImageDependencyFactory dep_factory{
+      "explorer.exe", std::make_shared<windep::image::pe::PeImageFactory>()};
+  const windep::graph::IndexedGraph<windep::image::Image> indexed{
+      dep_factory.Create()};
+  size_t bytes_read = 0;
+  size_t file_size = 0;
+  for (size_t i = 0; i < indexed.Size(); ++i) {
+    const auto pe_image = std::dynamic_pointer_cast<windep::image::pe::PeImage>(
+        indexed.Node(i)->GetContext());
+    REQUIRE(pe_image);
+    if (pe_image->Path().empty()) continue;
+    bytes_read += pe_image->BytesRead();
+    file_size += std::filesystem::file_size(pe_image->Path());
+  }
+  REQUIRE(bytes_read > 0);
+  REQUIRE(bytes_read < file_size / 10);
+}
+
+TEST_CASE("search_order", "[image]") {
+  // Paths are the same as of the modules mapped by the loader
+  windep::image::ImageDependencyFactory dep_factory{
+      "explorer.exe", std::make_shared<windep::image::pe::PeImageFactory>()};
+  const windep::graph::IndexedGraph<windep::image::Image> indexed{
+      dep_factory.Create()};
+  for (size_t i = 0; i < indexed.Size(); ++i) {
+    const auto& image = *indexed.Node(i)->GetContext();
+    if (image.Path().empty()) continue;
+    auto module = ::LoadLibraryExA(image.Name().c_str(), nullptr,
+                                   DONT_RESOLVE_DLL_REFERENCES);
+    REQUIRE(module);
+    std::vector<wchar_t> path(0x8000, L'\0');
+    const auto size = ::GetModuleFileNameW(module, path.data(),
+                                           static_cast<DWORD>(path.size()));
+    ::FreeLibrary(module);
+    REQUIRE(windep::utils::iequals(
+        windep::utils::w2a(std::wstring(path.data(), size)),
+        windep::utils::w2a(image.Path().wstring())));
+  }
+}
+
+TEST_CASE("read_ahead", "[image]") {
+  windep::image::pe::PeLoader loader{true};
+  loader.Prefetch({"kernel32.dll", "user32.dll", "unknown_image_name.dll"});
+  const auto load = loader.Take("user32.dll");
+  REQUIRE_FALSE(load.error);
+  REQUIRE(load.fingerprint);
+  REQUIRE(loader.Take("unknown_image_name.dll").error);
+  // Not prefetched image is read right away
+  REQUIRE(loader.Take("version.dll").image);
+  // Graphs are the same with and without reading ahead
+  const auto graph_size = [](size_t io_threads) {
+    auto img_fc = std::make_shared<windep::image::pe::PeImageFactory>(
+        true, true, io_threads);
+    windep::image::ImageDependencyFactory dep_factory{"explorer.exe", img_fc};
+    return windep::graph::IndexedGraph<windep::image::Image>{
+        dep_factory.Create()}
+        .Size();
+  };
+  REQUIRE(graph_size(0) == graph_size(windep::image::pe::PeLoader::kThreads));
+}
+
+TEST_CASE("case_folding", "[utils]") {
+  using windep::utils::hash;
+  using windep::utils::ihash;
+  using windep::utils::lower;
+  // Long enough to pass through the vector, word and byte loops
+  const std::string mixed =
+      "API-MS-Win-Core-ProcessThreads-L1-1-0.DLL\xC0\xDA@[`{Kernel32.dll";
+  const std::string lowered =
+      "api-ms-win-core-processthreads-l1-1-0.dll\xC0\xDA@[`{kernel32.dll";
+  REQUIRE(lower(mixed) == lowered);
+  REQUIRE(ihash(mixed) == hash(lowered));
+  REQUIRE(windep::utils::iequals(mixed, lowered));
+  REQUIRE_FALSE(windep::utils::iequals(mixed, lowered.substr(1)));
+  REQUIRE(windep::utils::istartswith(mixed, "api-"));
+  windep::FlatHashMap<std::string, int, windep::IStringHash, windep::IStringEq>
+      names;
+  names["KERNEL32.dll"] = 1;
+  REQUIRE(names.count(std::string_view("kernel32.DLL")));
+}
+
+TEST_CASE("utf", "[utils]") {
+  using windep::utils::a2w;
+  using windep::utils::w2a;
+  const std::wstring ascii =
+      L"C:\\Windows\\System32\\api-ms-win-core-l1-1-0.dll";
+  REQUIRE(a2w(w2a(ascii)) == ascii);
+  const std::wstring wide = ascii + L"\u00e9\u4e2d\U0001f600";
+  const std::string utf8 = w2a(ascii) + "\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80";
+  REQUIRE(w2a(wide) == utf8);
+  std::wstring buffer;
+  a2w(utf8, &buffer);
+  REQUIRE(buffer == wide);
+  REQUIRE_THROWS_AS(a2w("\xc0\x80"), windep::exc::Validation);
+  REQUIRE_THROWS_AS(w2a(std::wstring(1, static_cast<wchar_t>(0xd800))),
+                    windep::exc::Validation);
+  REQUIRE(windep::utils::iequals(L"API-MS-Win.dll", "api-ms-win.DLL"));
+}
+
 TEST_CASE("with_dependencies", "[dependencies]") {
   auto img_fc = std::make_shared<windep::image::pe::PeImageFactory>();
   auto dep_fc = windep::image::ImageDependencyFactory{"explorer.exe", img_fc};
@@ -70,6 +278,15 @@ std::shared_ptr<windep::Dependency<windep::image::Image>> CreateTree(
   return dep_factory.Create();
 }
 
+TEST_CASE("bindings", "[dependencies]") {
+  auto root = CreateTree("kernel32.dll", true);
+  for (const auto& import : root->GetContext()->Imports()) {
+    for (const auto& func : import->Functions()) {
+      REQUIRE_FALSE(func->IsUnresolved());
+    }
+  }
+}
+
 TEST_CASE("matrix", "[view,stdout,file,null]") {
   const std::string binary = "kernel32.dll";
   auto root = CreateTree(binary, false);
@@ -78,11 +295,15 @@ TEST_CASE("matrix", "[view,stdout,file,null]") {
   auto json_view = windep::view::Factory{"json"}.Create(true, 2);
   auto dot_view = windep::view::Factory{"dot"}.Create();
   auto csv_view = windep::view::Factory{"csv"}.Create();
+  auto scc_view = windep::view::Factory{"scc"}.Create();
+  auto load_order_view = windep::view::Factory{"load-order"}.Create();
+  auto dominators_view = windep::view::Factory{"dominators"}.Create();
   auto stdout_writer = windep::writer::StreamFactory().Create(L"");
   auto tmp_file = std::filesystem::temp_directory_path() / "windep_file_output";
   auto file_writer = windep::writer::StreamFactory().Create(tmp_file.wstring());
   auto null_writer = std::make_shared<NullWriter>();
-  for (auto view : {ascii_view, json_view, dot_view, csv_view}) {
+  for (auto view : {ascii_view, json_view, dot_view, csv_view, scc_view,
+                    load_order_view, dominators_view}) {
     for (auto writer : {stdout_writer, file_writer}) {
       REQUIRE_NOTHROW(view->Show(root, writer));
     }
@@ -90,3 +311,483 @@ TEST_CASE("matrix", "[view,stdout,file,null]") {
   }
   REQUIRE(std::filesystem::file_size(tmp_file) > 0);
 }
+
+TEST_CASE("fan_out", "[view]") {
+  auto root = CreateTree("kernel32.dll", false);
+  windep::view::FanOut fan_out;
+  std::vector<std::pair<std::string, std::string>> expected;
+  std::vector<std::shared_ptr<windep::writer::StringWriter>> writers;
+  for (auto format :
+       {"ascii", "json", "ndjson", "dot", "csv", "edges", "edges-ids",
+        "edges-names", "scc", "load-order", "dominators"}) {
+    auto single = std::make_shared<windep::writer::StringWriter>();
+    windep::view::Factory{format}.Create(true, 2)->Show(root, single);
+    expected.emplace_back(format, single->String());
+    writers.push_back(std::make_shared<windep::writer::StringWriter>());
+    fan_out.Add(windep::view::Factory{format}.Create(true, 2), writers.back());
+  }
+  fan_out.Show(root);
+  for (size_t i = 0; i < writers.size(); ++i) {
+    INFO(expected[i].first);
+    REQUIRE(writers[i]->String() == expected[i].second);
+  }
+}
+
+TEST_CASE("ndjson", "[view]") {
+  windep::session::Session session;
+  const auto graph = session.Analyze("kernel32.dll");
+  windep::session::RenderOptions options;
+  options.format = "ndjson";
+  options.functions = true;
+  std::istringstream lines{graph->Render(options)};
+  std::string line;
+  size_t nodes = 0;
+  while (std::getline(lines, line)) {
+    const auto node = nlohmann::json::parse(line);
+    REQUIRE(graph->Find(node.at("name").get<std::string>()));
+    REQUIRE(node.at("imports").is_object());
+    ++nodes;
+  }
+  REQUIRE(nodes == graph->Size());
+}
+
+TEST_CASE("edges", "[view]") {
+  windep::session::Session session;
+  const auto graph = session.Analyze("kernel32.dll", {true, true});
+  const auto render = [&graph](const std::string& format) {
+    windep::session::RenderOptions options;
+    options.format = format;
+    std::istringstream lines{graph->Render(options)};
+    std::vector<std::vector<std::string>> rows;
+    for (std::string line; std::getline(lines, line);) {
+      std::vector<std::string> row(1);
+      for (auto c : line) {
+        if (c == ',') {
+          row.emplace_back();
+        } else {
+          row.back() += c;
+        }
+      }
+      rows.push_back(std::move(row));
+    }
+    return rows;
+  };
+  const auto named = render("edges");
+  const auto ids = render("edges-ids");
+  const auto names = render("edges-names");
+  REQUIRE(named.front() ==
+          std::vector<std::string>{"Source", "Target", "Function", "Kind"});
+  REQUIRE(ids.front() == named.front());
+  REQUIRE(names.front() == std::vector<std::string>{"Table", "Id", "Name"});
+  std::unordered_map<std::string, std::unordered_map<std::string, std::string>>
+      tables;
+  for (size_t i = 1; i < names.size(); ++i) {
+    REQUIRE(names[i].size() == 3);
+    tables[names[i][0]][names[i][1]] = names[i][2];
+  }
+  // Ids of every row map back to the names of the same row
+  REQUIRE(named.size() > 1);
+  REQUIRE(ids.size() == named.size());
+  for (size_t i = 1; i < named.size(); ++i) {
+    REQUIRE(named[i].size() == 4);
+    REQUIRE(ids[i].size() == 4);
+    REQUIRE(tables.at("image").at(ids[i][0]) == named[i][0]);
+    REQUIRE(tables.at("image").at(ids[i][1]) == named[i][1]);
+    REQUIRE(tables.at("function").at(ids[i][2]) == named[i][2]);
+    REQUIRE(tables.at("kind").at(ids[i][3]) == named[i][3]);
+  }
+}
+
+TEST_CASE("batches", "[view]") {
+  using windep::image::ParallelTreeVisitor;
+  const auto root = CreateTree("explorer.exe", true);
+  const auto render = [&root](size_t batch_size, size_t min_chunk_size) {
+    std::vector<std::shared_ptr<windep::writer::StringWriter>> writers;
+    for (size_t i = 0; i < 3; ++i) {
+      writers.push_back(std::make_shared<windep::writer::StringWriter>());
+    }
+    const std::vector<std::shared_ptr<ParallelTreeVisitor>> visitors{
+        std::make_shared<windep::image::AsciiTreeVisitor>(
+            writers[0], true, 2, batch_size, min_chunk_size),
+        std::make_shared<windep::image::CsvTreeVisitor>(
+            writers[1], batch_size, min_chunk_size),
+        std::make_shared<windep::image::DotTreeVisitor>(
+            writers[2], 2, batch_size, min_chunk_size)};
+    for (const auto& visitor : visitors) {
+      windep::Dfs<windep::image::Image>{}.Traverse(root, visitor);
+      visitor->Finish();
+    }
+    std::vector<std::string> outputs;
+    for (const auto& writer : writers) outputs.push_back(writer->String());
+    return outputs;
+  };
+  // Output of one node per batch is formatted by one thread
+  const auto serial = render(1, 1);
+  REQUIRE(serial[0].size() > 0);
+  // Batches of 7 nodes split into chunks of 1 node cross both boundaries
+  // at almost every node
+  REQUIRE(render(7, 1) == serial);
+  REQUIRE(render(ParallelTreeVisitor::kBatchSize,
+                 ParallelTreeVisitor::kMinChunkSize) == serial);
+}
+
+TEST_CASE("session", "[session]") {
+  windep::session::Session session;
+  const auto graph = session.Analyze("kernel32.dll");
+  REQUIRE(graph->Size() > 1);
+  REQUIRE(graph->Find("NTDLL.DLL"));
+  REQUIRE_FALSE(graph->Find("unknown_image_name.dll"));
+  const auto cached_images = session.CachedImages();
+  REQUIRE(session.Analyze("kernel32.dll") == graph);
+  // Closure of kernelbase is a part of the kernel32 one, nothing to parse
+  REQUIRE(session.Analyze("kernelbase.dll")->Size() > 1);
+  REQUIRE(session.CachedImages() == cached_images);
+  windep::session::RenderOptions options;
+  options.format = "csv";
+  REQUIRE(graph->Render(options).rfind("Source,Target,Missing", 0) == 0);
+  session.Clear();
+  REQUIRE(session.CachedImages() == 0);
+  REQUIRE(session.Analyze("kernel32.dll") != graph);
+}
+
+TEST_CASE("pipeline", "[session]") {
+  const auto lines = [](const std::string& text) {
+    std::vector<std::string> result;
+    std::istringstream stream{text};
+    for (std::string line; std::getline(stream, line);) result.push_back(line);
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+  windep::session::RenderOptions options;
+  options.format = "csv";
+  const auto streamed = std::make_shared<windep::writer::StringWriter>();
+  windep::session::Session session;
+  const auto graph = session.Stream("kernel32.dll", {}, {{options, streamed}});
+  REQUIRE(graph == session.Analyze("kernel32.dll"));
+  // Same records as the BFS rendering, in the order of the parsing
+  const auto rendered = windep::session::Session()
+                            .Analyze("kernel32.dll")
+                            ->Render(options);
+  REQUIRE(lines(streamed->String()) == lines(rendered));
+  options.format = "ascii";
+  REQUIRE_THROWS_AS(session.Stream("kernel32.dll", {}, {{options, streamed}}),
+                    windep::exc::Validation);
+}
+
+TEST_CASE("capi", "[session]") {
+  auto session = windep_session_create();
+  REQUIRE(session);
+  auto graph = windep_analyze(session, "kernel32.dll", 0, 1);
+  REQUIRE(graph);
+  REQUIRE(windep_graph_size(graph) > 1);
+  REQUIRE(windep_graph_contains(graph, "ntdll.dll") == 1);
+  windep_session_destroy(session);
+  const std::string output = windep_render(graph, "json", 1, 2);
+  REQUIRE(nlohmann::json::parse(output).is_object());
+  REQUIRE_FALSE(windep_render(graph, "unknown_format", 0, 2));
+  REQUIRE(std::string(windep_last_error()).size());
+  REQUIRE_FALSE(windep_analyze(nullptr, "kernel32.dll", 0, 1));
+  windep_graph_release(graph);
+}
+
+TEST_CASE("scc", "[graph]") {
+  // 0 <-> 1 -> 2 <-> 3
+  windep::graph::Adjacency edges;
+  for (const auto& targets :
+       std::vector<std::vector<size_t>>{{1}, {0, 2}, {3}, {2}}) {
+    edges.targets.insert(edges.targets.end(), targets.begin(), targets.end());
+    edges.offsets.push_back(edges.targets.size());
+  }
+  const auto components = windep::graph::StronglyConnected(edges);
+  const auto& component = components.component;
+  REQUIRE(components.members.size() == 2);
+  REQUIRE(component[0] == component[1]);
+  REQUIRE(component[2] == component[3]);
+  REQUIRE(component[2] < component[0]);
+  const auto& dag = components.dag;
+  REQUIRE(dag.End(component[0]) - dag.Begin(component[0]) == 1);
+  REQUIRE(*dag.Begin(component[0]) == component[2]);
+  REQUIRE(dag.Begin(component[2]) == dag.End(component[2]));
+  const windep::graph::IndexedGraph<windep::image::Image> indexed{
+      CreateTree("kernel32.dll")};
+  const auto system = windep::graph::StronglyConnected(indexed.Edges());
+  REQUIRE(system.component[0] == system.members.size() - 1);
+}
+
+TEST_CASE("load_order", "[graph]") {
+  const windep::graph::IndexedGraph<windep::image::Image> indexed{
+      CreateTree("explorer.exe")};
+  const auto components = windep::graph::StronglyConnected(indexed.Edges());
+  const auto depths = windep::graph::ComponentDepths(components);
+  const auto order = windep::graph::TopologicalOrder(components, depths);
+  REQUIRE(order.size() == indexed.Size());
+  // Root is initialized last, every import before its importer
+  REQUIRE(order.back() == 0);
+  std::vector<size_t> position(order.size());
+  for (size_t i = 0; i < order.size(); ++i) position[order[i]] = i;
+  const auto& edges = indexed.Edges();
+  for (size_t node = 0; node < indexed.Size(); ++node) {
+    for (auto it = edges.Begin(node); it != edges.End(node); ++it) {
+      if (components.component[node] != components.component[*it]) {
+        REQUIRE(position[*it] < position[node]);
+      }
+    }
+  }
+}
+
+TEST_CASE("dominators", "[graph]") {
+  // 0 -> 1 -> 3, 0 -> 2 -> 3 -> 4 -> 3
+  windep::graph::Adjacency edges;
+  for (const auto& targets :
+       std::vector<std::vector<size_t>>{{1, 2}, {3}, {3}, {4}, {3}, {}}) {
+    edges.targets.insert(edges.targets.end(), targets.begin(), targets.end());
+    edges.offsets.push_back(edges.targets.size());
+  }
+  const auto idoms = windep::graph::ImmediateDominators(edges);
+  REQUIRE(idoms == std::vector<size_t>{0, 0, 0, 0, 3, windep::graph::kNoNode});
+  REQUIRE(windep::graph::DominatorChain(idoms, 4) ==
+          std::vector<size_t>{0, 3});
+  const auto graph = windep::session::Session().Analyze("kernel32.dll");
+  REQUIRE(graph->Gateways("ntdll.dll") ==
+          std::vector<std::string>{graph->Root()->GetContext()->Name()});
+  REQUIRE_THROWS_AS(graph->Gateways("unknown_image_name.dll"),
+                    windep::exc::NotFound);
+}
+
+TEST_CASE("bitset", "[graph]") {
+  using windep::graph::Bitset;
+  const auto bits = [](const Bitset& bitset) {
+    std::vector<size_t> set;
+    bitset.ForEach([&set](size_t bit) { set.push_back(bit); });
+    return set;
+  };
+  // Runs [100, 200) and [300, 301) in the sparse one, every third bit in
+  // the dense one
+  Bitset sparse{1000};
+  for (size_t bit = 100; bit < 200; ++bit) sparse.Set(bit);
+  sparse.Set(300);
+  Bitset dense{1000};
+  for (size_t bit = 0; bit < 1000; bit += 3) dense.Set(bit);
+  REQUIRE(sparse.Count() == 101);
+  REQUIRE(sparse.Memory() < dense.Memory());
+  REQUIRE(sparse.Test(150));
+  REQUIRE_FALSE(sparse.Test(200));
+  auto runs_union = sparse;
+  runs_union |= Bitset{1000};
+  REQUIRE(runs_union == sparse);
+  auto mixed = sparse;
+  mixed &= dense;
+  REQUIRE(mixed.Count() == 34);
+  REQUIRE(bits(mixed).front() == 102);
+  mixed = sparse;
+  mixed -= dense;
+  REQUIRE(mixed.Count() == 67);
+  REQUIRE_FALSE(mixed.Test(300));
+  mixed |= dense;
+  REQUIRE(mixed.Count() == 334 + 67);
+  REQUIRE(bits(mixed).size() == mixed.Count());
+}
+
+TEST_CASE("closure_index", "[graph]") {
+  windep::session::Session session;
+  const auto index =
+      session.Index({"kernel32.dll", "ntdll.dll", "explorer.exe"});
+  REQUIRE(index->Depends("kernel32.dll", "ntdll.dll"));
+  REQUIRE_FALSE(index->Depends("ntdll.dll", "kernel32.dll"));
+  REQUIRE_FALSE(index->Depends("ntdll.dll", "unknown_image_name.dll"));
+  REQUIRE(index->Dependents("ntdll.dll").size() == 3);
+  REQUIRE(index->Dependents("explorer.exe") ==
+          std::vector<std::string>{"explorer.exe"});
+  REQUIRE(index->ClosureSize("ntdll.dll") == 1);
+  REQUIRE(index->ClosureSize("kernel32.dll") ==
+          session.Analyze("kernel32.dll")->Size());
+  REQUIRE(index->Intersection("kernel32.dll", "ntdll.dll").size() == 1);
+  REQUIRE(index->Difference("ntdll.dll", "kernel32.dll").empty());
+  REQUIRE(index->Union("kernel32.dll", "ntdll.dll").size() ==
+          index->ClosureSize("kernel32.dll"));
+  REQUIRE_THROWS_AS(index->ClosureSize("unknown_image_name.dll"),
+                    windep::exc::NotFound);
+}
+
+TEST_CASE("lazy_traversal", "[graph]") {
+  using Node = std::pair<std::string, size_t>;
+  class Collector : public windep::TreeVisitor<windep::image::Image> {
+   public:
+    std::vector<Node> nodes;
+    void Visit(std::shared_ptr<windep::Dependency<windep::image::Image>> node,
+               size_t height) override {
+      nodes.emplace_back(node->GetContext()->Name(), height);
+    }
+  };
+  const auto root = CreateTree("explorer.exe");
+  for (const auto direction :
+       {windep::DfsDirection::kToLeaf, windep::DfsDirection::kFromLeaf}) {
+    auto collector = std::make_shared<Collector>();
+    windep::Dfs<windep::image::Image>{direction}.Traverse(root, collector);
+    windep::Dfs<windep::image::Image> dfs{direction};
+    // Walk stopped in the middle doesn't affect the next one
+    for (const auto& [node, height] : dfs.Walk(root)) {
+      if (height > 1) break;
+    }
+    std::vector<Node> walked;
+    for (const auto& [node, height] : dfs.Walk(root)) {
+      walked.emplace_back(node->GetContext()->Name(), height);
+    }
+    REQUIRE(walked == collector->nodes);
+  }
+  auto collector = std::make_shared<Collector>();
+  windep::Bfs<windep::image::Image>{}.Traverse(root, collector);
+  // Walk stops at the first found image without visiting the rest
+  windep::Bfs<windep::image::Image> bfs;
+  std::vector<Node> walked;
+  for (const auto& [node, height] : bfs.Walk(root)) {
+    walked.emplace_back(node->GetContext()->Name(), height);
+    if (node->GetContext()->Name() == "ntdll.dll") break;
+  }
+  REQUIRE(walked.size() < collector->nodes.size());
+  REQUIRE(std::equal(walked.begin(), walked.end(), collector->nodes.begin()));
+  walked.clear();
+  for (const auto& [node, height] : bfs.Walk(root)) {
+    walked.emplace_back(node->GetContext()->Name(), height);
+  }
+  REQUIRE(walked == collector->nodes);
+}
+
+TEST_CASE("crawl", "[crawl]") {
+  using windep::crawl::Match;
+  REQUIRE(Match("*.dll", "VERSION.DLL"));
+  REQUIRE(Match("a?c*e", "abcde"));
+  REQUIRE_FALSE(Match("*.dll", "version.exe"));
+  REQUIRE_FALSE(Match("a*b", "acbc"));
+  windep::image::pe::PeImage version{"version.dll", false};
+  REQUIRE_NOTHROW(version.Parse());
+  const auto root = std::filesystem::temp_directory_path() / "windep_crawl";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root / "bin");
+  std::filesystem::create_directories(root / "tests");
+  std::filesystem::copy_file(version.Path(), root / "bin" / "version.dll");
+  std::filesystem::copy_file(version.Path(), root / "tests" / "version.dll");
+  std::ofstream(root / "bin" / "readme.dll") << "not a PE file";
+  REQUIRE(windep::crawl::Crawl(root).size() == 2);
+  windep::crawl::Options options;
+  options.exclude = {"tests"};
+  const auto files = windep::crawl::Crawl(root, options);
+  REQUIRE(files.size() == 1);
+  options.include = {"*.exe"};
+  REQUIRE(windep::crawl::Crawl(root, options).empty());
+  // Junction to the root is skipped, or entered once if links are followed
+  const auto junction = "mklink /J \"" + (root / "loop").string() + "\" \"" +
+                        root.string() + "\"";
+  REQUIRE(std::system(junction.c_str()) == 0);
+  REQUIRE(windep::crawl::Crawl(root).size() == 2);
+  windep::crawl::Options follow;
+  follow.symlinks = windep::crawl::Symlinks::kFollow;
+  REQUIRE(windep::crawl::Crawl(root, follow).size() == 2);
+  const auto path = files.front().u8string();
+  std::vector<std::string> failed;
+  const auto index =
+      windep::session::Session().Index({path, "unknown_image_name.dll"}, {},
+                                       &failed);
+  REQUIRE(failed == std::vector<std::string>{"unknown_image_name.dll"});
+  REQUIRE(index->ClosureSize(path) > 1);
+}
+
+TEST_CASE("diff", "[diff]") {
+  const auto root = CreateTree("kernel32.dll");
+  auto writer = std::make_shared<windep::writer::StringWriter>();
+  windep::view::Factory{"json"}.Create(true, 0)->Show(root, writer);
+  windep::diff::Differ differ;
+  const auto live = differ.Load(root);
+  const auto saved = differ.Load(nlohmann::json::parse(writer->String()));
+  REQUIRE(differ.Compare(saved, live).Empty());
+  const auto leaf = differ.Load(CreateTree("ntdll.dll"));
+  const auto result = differ.Compare(live, leaf);
+  REQUIRE(result.added.nodes.empty());
+  REQUIRE(result.removed.nodes.size() == live.Size() - 1);
+  REQUIRE(result.removed.edges.size());
+  for (const auto format : {"ascii", "json", "csv"}) {
+    auto output = std::make_shared<windep::writer::StringWriter>();
+    windep::diff::Show(result, format, 2, output);
+    REQUIRE(output->String().size());
+  }
+  REQUIRE_THROWS_AS(differ.Load(nlohmann::json::array()),
+                    windep::exc::Validation);
+}
+
+TEST_CASE("why", "[query]") {
+  using windep::query::Target;
+  auto img_fc = std::make_shared<windep::image::pe::PeImageFactory>();
+  windep::query::ChainQuery query{img_fc};
+  const auto chains = query.Find("explorer.exe", Target::Parse("ntdll.dll"));
+  REQUIRE(chains.size());
+  for (const auto& chain : chains) {
+    REQUIRE(chain.size() == chains.front().size());
+    REQUIRE(chain.front().image == "explorer.exe");
+    REQUIRE(windep::utils::iequals(chain.back().image, "ntdll.dll"));
+  }
+  // Search stops before the whole closure is parsed
+  const auto closure = windep::session::Session().Analyze("explorer.exe");
+  REQUIRE(query.Expanded() < closure->Size());
+  const auto target = Target::Parse("ntdll.dll!RtlAllocateHeap");
+  const auto func_chains = query.Find("kernel32.dll", target);
+  REQUIRE(func_chains.size());
+  REQUIRE(windep::query::Format(func_chains.front(), target)
+              .find("!RtlAllocateHeap") != std::string::npos);
+  REQUIRE(query.Find("ntdll.dll", Target::Parse("kernel32.dll")).empty());
+  REQUIRE_THROWS_AS(
+      query.Find("unknown_image_name.dll", Target::Parse("ntdll.dll")),
+      windep::exc::NotFound);
+  REQUIRE_THROWS_AS(Target::Parse(""), windep::exc::Validation);
+}
+
+TEST_CASE("server", "[server]") {
+  auto writer = std::make_shared<windep::writer::StringWriter>();
+  windep::view::Factory{"json"}.Create(true, 2)->Show(
+      CreateTree("kernel32.dll"), writer);
+  windep::server::Server server;
+  const auto request = R"({"id": 7, "image": "kernel32.dll", "format": "json",
+                            "functions": true})";
+  for (size_t i = 0; i < 2; ++i) {
+    const auto response = nlohmann::json::parse(server.Handle(request));
+    REQUIRE(response["id"] == 7);
+    REQUIRE(response["output"] == writer->String());
+  }
+  auto error = nlohmann::json::parse(server.Handle(R"({"id": 8})"));
+  REQUIRE(error.contains("error"));
+  error = nlohmann::json::parse(server.Handle("not a json"));
+  REQUIRE(error.contains("error"));
+  std::stringstream input{R"({"command": "clear"})"
+                          "\r\n\n"
+                          R"({"image": "unknown_image_name.dll"})"};
+  std::stringstream output;
+  server.Serve(input, output);
+  std::string line;
+  REQUIRE(std::getline(output, line));
+  REQUIRE(nlohmann::json::parse(line)["output"] == "");
+  REQUIRE(std::getline(output, line));
+  REQUIRE(nlohmann::json::parse(line).contains("error"));
+}
+
+TEST_CASE("lookups", "[!benchmark]") {
+  BENCHMARK("graph_build") { return CreateTree("explorer.exe", true); };
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 4096; ++i) {
+    keys.push_back("api-ms-win-core-" + std::to_string(i) + "-l1-1-0.dll");
+  }
+  std::unordered_map<std::string, size_t> node_map;
+  windep::FlatHashMap<std::string, size_t> flat_map;
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    node_map[keys[i]] = i;
+    flat_map[keys[i]] = i;
+  }
+  BENCHMARK("unordered_map_find") {
+    size_t found = 0;
+    for (const auto& key : keys) found += node_map.count(key);
+    return found;
+  };
+  BENCHMARK("flat_hash_map_find") {
+    size_t found = 0;
+    for (const auto& key : keys) found += flat_map.count(key);
+    return found;
+  };
+}
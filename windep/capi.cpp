@@ -0,0 +1,103 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#include "capi.h"
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+
+#include "exceptions.h"
+#include "session.h"
+
+struct windep_session {
+  windep::session::Session session;
+};
+
+struct windep_graph {
+  std::shared_ptr<const windep::session::Graph> graph;
+  std::string output;
+};
+
+namespace {
+thread_local std::string last_error;
+
+// Exceptions must not cross the C boundary
+template <typename Result, typename Function>
+Result Guard(Result failure, Function function) {
+  try {
+    last_error.clear();
+    return function();
+  } catch (const std::exception& e) {
+    last_error = e.what();
+  } catch (...) {
+    last_error = "Unknown error";
+  }
+  return failure;
+}
+
+void Require(const void* arg, const char* name) {
+  if (!arg) {
+    throw windep::exc::Validation(std::string("Argument is NULL: ") + name);
+  }
+}
+}  // namespace
+
+windep_session* windep_session_create(void) {
+  return Guard<windep_session*>(nullptr, [] { return new windep_session; });
+}
+
+void windep_session_clear(windep_session* session) {
+  if (session) session->session.Clear();
+}
+
+void windep_session_destroy(windep_session* session) { delete session; }
+
+windep_graph* windep_analyze(windep_session* session, const char* image,
+                             int delayed, int forwarders) {
+  return Guard<windep_graph*>(nullptr, [&] {
+    Require(session, "session");
+    Require(image, "image");
+    windep::session::Options options;
+    options.delayed = delayed != 0;
+    options.forwarders = forwarders != 0;
+    auto graph = std::make_unique<windep_graph>();
+    graph->graph = session->session.Analyze(image, options);
+    return graph.release();
+  });
+}
+
+const char* windep_render(windep_graph* graph, const char* format,
+                          int functions, int indent) {
+  return Guard<const char*>(nullptr, [&] {
+    Require(graph, "graph");
+    windep::session::RenderOptions options;
+    if (format) options.format = format;
+    options.functions = functions != 0;
+    if (indent < 0 || indent > UINT8_MAX) {
+      throw windep::exc::Validation("Indent is out of range");
+    }
+    options.indent = static_cast<uint8_t>(indent);
+    graph->output = graph->graph->Render(options);
+    return graph->output.c_str();
+  });
+}
+
+int windep_graph_size(const windep_graph* graph) {
+  return Guard(-1, [&] {
+    Require(graph, "graph");
+    return static_cast<int>(graph->graph->Size());
+  });
+}
+
+int windep_graph_contains(const windep_graph* graph, const char* image) {
+  return Guard(-1, [&] {
+    Require(graph, "graph");
+    Require(image, "image");
+    return graph->graph->Find(image) ? 1 : 0;
+  });
+}
+
+void windep_graph_release(windep_graph* graph) { delete graph; }
+
+const char* windep_last_error(void) { return last_error.c_str(); }
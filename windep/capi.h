@@ -0,0 +1,38 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+/*
+  Plain C interface of the library, e.g. for Python ctypes. Functions return
+  NULL or -1 on failure, the reason is returned by the windep_last_error of
+  the same thread.
+*/
+#pragma once
+#if defined(WINDEP_EXPORTS)
+#define WINDEP_API __declspec(dllexport)
+#else
+#define WINDEP_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+typedef struct windep_session windep_session;
+typedef struct windep_graph windep_graph;
+
+WINDEP_API windep_session* windep_session_create(void);
+WINDEP_API void windep_session_clear(windep_session* session);
+WINDEP_API void windep_session_destroy(windep_session* session);
+// Graph stays valid after the session is cleared or destroyed
+WINDEP_API windep_graph* windep_analyze(windep_session* session,
+                                        const char* image, int delayed,
+                                        int forwarders);
+// Rendered text is owned by the graph and valid till the next render
+WINDEP_API const char* windep_render(windep_graph* graph, const char* format,
+                                     int functions, int indent);
+WINDEP_API int windep_graph_size(const windep_graph* graph);
+WINDEP_API int windep_graph_contains(const windep_graph* graph,
+                                     const char* image);
+WINDEP_API void windep_graph_release(windep_graph* graph);
+WINDEP_API const char* windep_last_error(void);
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,180 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#include "crawl.h"
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "flat_hash.h"
+
+namespace windep::crawl {
+namespace {
+char Lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+bool MatchAny(const std::vector<std::string>& globs, std::string_view text) {
+  for (const auto& glob : globs) {
+    if (Match(glob, text)) return true;
+  }
+  return false;
+}
+
+// Junctions and directory links redirect to another path. Unlike the
+// symlinks, the junctions are directories for std::filesystem.
+bool IsLink(const std::filesystem::directory_entry& entry) {
+  std::error_code error;
+  if (entry.is_symlink(error)) return true;
+  if (!entry.is_directory(error)) return false;
+  WIN32_FIND_DATAW data;
+  auto find = ::FindFirstFileW(entry.path().c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE) return false;
+  ::FindClose(find);
+  // Other reparse points, e.g. of the cloud files, are real directories
+  return (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) &&
+         IsReparseTagNameSurrogate(data.dwReserved0);
+}
+
+class Crawler {
+  const std::filesystem::path& root_;
+  const Options& options_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::vector<std::filesystem::path> pending_;
+  // Number of the directories, which are being enumerated
+  size_t busy_ = 0;
+  std::vector<std::filesystem::path> found_;
+  // Canonical paths of the entered directories, if the links are followed
+  FlatHashSet<std::string, IStringHash, IStringEq> visited_;
+
+  void Enumerate(const std::filesystem::path& dir,
+                 std::vector<std::filesystem::path>* dirs,
+                 std::vector<std::filesystem::path>* files) const {
+    std::error_code error;
+    std::filesystem::directory_iterator entries{dir, error};
+    // Unreadable directories and entries are skipped, e.g. access denied
+    for (; !error && entries != std::filesystem::directory_iterator{};
+         entries.increment(error)) {
+      const auto& entry = *entries;
+      std::error_code status_error;
+      if (options_.symlinks == Symlinks::kSkip && IsLink(entry)) continue;
+      const auto relative =
+          entry.path().lexically_relative(root_).generic_u8string();
+      if (MatchAny(options_.exclude, relative)) continue;
+      if (entry.is_directory(status_error)) {
+        dirs->push_back(entry.path());
+      } else if (entry.is_regular_file(status_error) &&
+                 (options_.include.empty() ||
+                  MatchAny(options_.include,
+                           entry.path().filename().u8string())) &&
+                 IsPe(entry.path())) {
+        files->push_back(entry.path());
+      }
+    }
+  }
+
+  // Directory is entered once, even if it is reached by many links
+  bool Enter(const std::filesystem::path& dir) {
+    if (options_.symlinks == Symlinks::kSkip) return true;
+    std::error_code error;
+    const auto canonical = std::filesystem::canonical(dir, error);
+    return !error && visited_.insert(canonical.u8string()).second;
+  }
+
+  void Work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [this] { return pending_.size() || !busy_; });
+      // Nothing to enumerate and nobody can add more
+      if (pending_.empty()) return;
+      const auto dir = std::move(pending_.back());
+      pending_.pop_back();
+      ++busy_;
+      lock.unlock();
+      std::vector<std::filesystem::path> dirs;
+      std::vector<std::filesystem::path> files;
+      Enumerate(dir, &dirs, &files);
+      lock.lock();
+      --busy_;
+      for (auto& child : dirs) {
+        if (Enter(child)) pending_.push_back(std::move(child));
+      }
+      std::move(files.begin(), files.end(), std::back_inserter(found_));
+      wake_.notify_all();
+    }
+  }
+
+ public:
+  Crawler(const std::filesystem::path& root, const Options& options)
+      : root_(root), options_(options) {}
+
+  std::vector<std::filesystem::path> Run() {
+    if (Enter(root_)) pending_.push_back(root_);
+    const size_t threads =
+        options_.threads
+            ? options_.threads
+            : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < threads; ++i) {
+      pool.emplace_back(&Crawler::Work, this);
+    }
+    Work();
+    for (auto& worker : pool) worker.join();
+    std::sort(found_.begin(), found_.end());
+    return std::move(found_);
+  }
+};
+}  // namespace
+
+bool Match(std::string_view glob, std::string_view text) {
+  size_t g = 0;
+  size_t t = 0;
+  // Position after the last star and the text matched by it, on mismatch
+  // the star takes one more character
+  auto star = std::string_view::npos;
+  size_t star_text = 0;
+  while (t < text.size()) {
+    if (g < glob.size() && glob[g] == '*') {
+      star = ++g;
+      star_text = t;
+    } else if (g < glob.size() &&
+               (glob[g] == '?' || Lower(glob[g]) == Lower(text[t]))) {
+      ++g;
+      ++t;
+    } else if (star != std::string_view::npos) {
+      g = star;
+      t = ++star_text;
+    } else {
+      return false;
+    }
+  }
+  while (g < glob.size() && glob[g] == '*') ++g;
+  return g == glob.size();
+}
+
+bool IsPe(const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  IMAGE_DOS_HEADER dos_header;
+  if (!file.read(reinterpret_cast<char*>(&dos_header), sizeof(dos_header)) ||
+      dos_header.e_magic != IMAGE_DOS_SIGNATURE || dos_header.e_lfanew < 0) {
+    return false;
+  }
+  DWORD signature = 0;
+  file.seekg(dos_header.e_lfanew);
+  return file.read(reinterpret_cast<char*>(&signature), sizeof(signature)) &&
+         signature == IMAGE_NT_SIGNATURE;
+}
+
+std::vector<std::filesystem::path> Crawl(const std::filesystem::path& root,
+                                         const Options& options) {
+  return Crawler{root, options}.Run();
+}
+}  // namespace windep::crawl
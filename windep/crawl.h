@@ -0,0 +1,36 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#pragma once
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace windep::crawl {
+enum class Symlinks : uint8_t { kSkip, kFollow };
+
+struct Options {
+  // Globs of the file names, e.g. "*.dll", every file is checked if empty
+  std::vector<std::string> include;
+  // Globs of the paths relative to the root with '/' separators, e.g.
+  // "tests/*", matching files and directories are skipped
+  std::vector<std::string> exclude;
+  // Symlinks and junctions, followed links are visited once, even if they
+  // form a cycle
+  Symlinks symlinks = Symlinks::kSkip;
+  // Number of the enumerating threads, hardware concurrency if 0
+  size_t threads = 0;
+};
+
+// Case insensitive glob, '*' matches any sequence and '?' any character
+bool Match(std::string_view glob, std::string_view text);
+// Checks the DOS and NT signatures, the rest of the file is not read
+bool IsPe(const std::filesystem::path& path);
+/*
+  PE files under the root in the sorted order. Directories are enumerated by
+  many threads, every thread takes the next pending directory, so the crawl
+  is bound by the file system rather than by the headers checks.
+*/
+std::vector<std::filesystem::path> Crawl(const std::filesystem::path& root,
+                                         const Options& options = {});
+}  // namespace windep::crawl
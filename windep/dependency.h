@@ -3,10 +3,10 @@
 #pragma once
 #include <memory>
 #include <string>
-#include <unordered_set>
 #include <vector>
 
 #include "context.h"
+#include "flat_hash.h"
 
 namespace windep {
 template <typename T>
@@ -44,8 +44,8 @@ class Dependency {
   using Context = T;
   using ParentsCollection = std::vector<std::weak_ptr<Dependency>>;
   using ChildrenCollection =
-      std::unordered_set<std::shared_ptr<Dependency>, Dependency::HashShared,
-                         Dependency::CompareShared>;
+      FlatHashSet<std::shared_ptr<Dependency>, Dependency::HashShared,
+                  Dependency::CompareShared>;
 
  protected:
   ParentsCollection parents_;
@@ -0,0 +1,243 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#include "diff.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "exceptions.h"
+#include "graph.h"
+#include "utils.h"
+
+namespace windep::diff {
+namespace {
+uint64_t EdgeKey(uint32_t from, uint32_t to) {
+  return static_cast<uint64_t>(from) << 32 | to;
+}
+
+// Appends functions which are only in the first sorted range
+void AppendMissing(const std::vector<std::string>& l,
+                   const std::vector<std::string>& r, const std::string& from,
+                   const std::string& to,
+                   std::vector<FunctionChange>* changes) {
+  auto r_it = r.begin();
+  for (const auto& function : l) {
+    while (r_it != r.end() && *r_it < function) ++r_it;
+    if (r_it == r.end() || *r_it != function) {
+      changes->push_back({from, to, function});
+    }
+  }
+}
+
+void Sort(Changes* changes) {
+  std::sort(changes->nodes.begin(), changes->nodes.end());
+  std::sort(changes->edges.begin(), changes->edges.end());
+  std::sort(changes->functions.begin(), changes->functions.end(),
+            [](const FunctionChange& l, const FunctionChange& r) {
+              return std::tie(l.from, l.to, l.function) <
+                     std::tie(r.from, r.to, r.function);
+            });
+}
+}  // namespace
+
+uint32_t Interner::Intern(const std::string& name) {
+  const auto [id_it, inserted] =
+      ids_.emplace(name, static_cast<uint32_t>(names_.size()));
+  if (inserted) names_.push_back(name);
+  return id_it->second;
+}
+
+const std::string& Interner::Name(uint32_t id) const { return names_[id]; }
+
+void Snapshot::AddEdge(uint32_t from, uint32_t to,
+                       std::vector<std::string> functions) {
+  std::sort(functions.begin(), functions.end());
+  const auto [edge_it, inserted] =
+      edge_index_.emplace(EdgeKey(from, to), edges_.size());
+  if (inserted) {
+    edges_.push_back({from, to, std::move(functions)});
+  }
+}
+
+Snapshot Snapshot::FromGraph(std::shared_ptr<Dependency<image::Image>> root,
+                             Interner* interner) {
+  Snapshot snapshot;
+  snapshot.functions_ = true;
+  const graph::IndexedGraph<image::Image> indexed{root};
+  for (size_t node = 0; node < indexed.Size(); ++node) {
+    const auto image_ctx = indexed.Node(node)->GetContext();
+    const auto from = interner->Intern(image_ctx->Name());
+    snapshot.nodes_.push_back(from);
+    for (const auto& import : image_ctx->Imports()) {
+      std::vector<std::string> functions;
+      functions.reserve(import->Functions().size());
+      for (const auto& func : import->Functions()) {
+        functions.push_back(func->Name());
+      }
+      snapshot.AddEdge(from, interner->Intern(import->Name()),
+                       std::move(functions));
+    }
+  }
+  return snapshot;
+}
+
+Snapshot Snapshot::FromJson(const json& graph, Interner* interner) {
+  if (!graph.is_object() || graph.size() != 1 ||
+      !graph.begin()->contains("imports")) {
+    throw exc::Validation("Unexpected json graph, use the json format output");
+  }
+  Snapshot snapshot;
+  snapshot.functions_ = true;
+  for (const auto& [name, node] : graph.begin()->at("imports").items()) {
+    const auto from = interner->Intern(name);
+    snapshot.nodes_.push_back(from);
+    for (const auto& [import_name, import] : node.at("imports").items()) {
+      std::vector<std::string> functions;
+      if (import.contains("functions")) {
+        functions = import["functions"].get<std::vector<std::string>>();
+      } else {
+        snapshot.functions_ = false;
+      }
+      snapshot.AddEdge(from, interner->Intern(import_name),
+                       std::move(functions));
+    }
+  }
+  return snapshot;
+}
+
+bool Result::Empty() const {
+  for (const auto* changes : {&added, &removed}) {
+    if (changes->nodes.size() || changes->edges.size() ||
+        changes->functions.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Differ::Differ() : interner_(std::make_shared<Interner>()) {}
+
+Snapshot Differ::Load(std::shared_ptr<Dependency<image::Image>> root) {
+  return Snapshot::FromGraph(root, interner_.get());
+}
+
+Snapshot Differ::Load(const json& graph) {
+  return Snapshot::FromJson(graph, interner_.get());
+}
+
+Snapshot Differ::Load(const std::string& path) {
+  std::ifstream input{std::filesystem::u8path(path)};
+  if (!input) {
+    throw exc::NotFound("Cannot open '" + path + "'");
+  }
+  try {
+    return Load(json::parse(input));
+  } catch (const json::exception& e) {
+    throw exc::Validation("Cannot parse '" + path + "': " + e.what());
+  }
+}
+
+Result Differ::Compare(const Snapshot& before, const Snapshot& after) const {
+  Result result;
+  const auto& interner = *interner_;
+  const auto compare_nodes = [&](const Snapshot& l, const Snapshot& r,
+                                 Changes* changes) {
+    FlatHashSet<uint32_t> r_nodes;
+    r_nodes.reserve(r.nodes_.size());
+    for (const auto node : r.nodes_) r_nodes.insert(node);
+    for (const auto node : l.nodes_) {
+      if (!r_nodes.count(node)) changes->nodes.push_back(interner.Name(node));
+    }
+  };
+  compare_nodes(before, after, &result.removed);
+  compare_nodes(after, before, &result.added);
+
+  const auto functions = before.functions_ && after.functions_;
+  for (const auto& edge : before.edges_) {
+    const auto& from = interner.Name(edge.from);
+    const auto& to = interner.Name(edge.to);
+    auto edge_it = after.edge_index_.find(EdgeKey(edge.from, edge.to));
+    if (edge_it == after.edge_index_.end()) {
+      result.removed.edges.emplace_back(from, to);
+    } else if (functions) {
+      const auto& after_functions = after.edges_[edge_it->second].functions;
+      AppendMissing(edge.functions, after_functions, from, to,
+                    &result.removed.functions);
+      AppendMissing(after_functions, edge.functions, from, to,
+                    &result.added.functions);
+    }
+  }
+  for (const auto& edge : after.edges_) {
+    if (!before.edge_index_.count(EdgeKey(edge.from, edge.to))) {
+      result.added.edges.emplace_back(interner.Name(edge.from),
+                                      interner.Name(edge.to));
+    }
+  }
+  Sort(&result.added);
+  Sort(&result.removed);
+  return result;
+}
+
+void Show(const Result& result, const std::string& format, uint8_t indent,
+          std::shared_ptr<writer::Writer> writer) {
+  const auto lowered = utils::lower(format);
+  const std::pair<const char*, const Changes*> sections[] = {
+      {"added", &result.added}, {"removed", &result.removed}};
+  if (lowered == "json") {
+    json output = json::object();
+    for (const auto& [name, changes] : sections) {
+      json functions = json::array();
+      for (const auto& change : changes->functions) {
+        functions.push_back({{"source", change.from},
+                             {"target", change.to},
+                             {"function", change.function}});
+      }
+      output[name] = {{"nodes", changes->nodes},
+                      {"edges", changes->edges},
+                      {"functions", std::move(functions)}};
+    }
+    writer->Write(output.dump(indent ? indent : -1) + '\n');
+    return;
+  }
+  std::stringstream output;
+  if (lowered == "csv") {
+    output << "Change,Kind,Source,Target,Function\n";
+    for (const auto& [name, changes] : sections) {
+      for (const auto& node : changes->nodes) {
+        output << name << ",node," << node << ",,\n";
+      }
+      for (const auto& [from, to] : changes->edges) {
+        output << name << ",edge," << from << ',' << to << ",\n";
+      }
+      for (const auto& change : changes->functions) {
+        output << name << ",function," << change.from << ',' << change.to
+               << ',' << change.function << '\n';
+      }
+    }
+  } else if (lowered == "ascii") {
+    for (const auto& [name, changes] : sections) {
+      const auto sign = changes == &result.added ? "+ " : "- ";
+      for (const auto& node : changes->nodes) {
+        output << sign << node << '\n';
+      }
+      for (const auto& [from, to] : changes->edges) {
+        output << sign << from << " -> " << to << '\n';
+      }
+      for (const auto& change : changes->functions) {
+        output << sign << change.from << " -> " << change.to << '!'
+               << change.function << '\n';
+      }
+    }
+  } else {
+    throw exc::NotFound("Unsupported diff format");
+  }
+  writer->Write(output);
+}
+}  // namespace windep::diff
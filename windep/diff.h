@@ -0,0 +1,90 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dependency.h"
+#include "flat_hash.h"
+#include "image.h"
+#include "json/json.hpp"
+#include "writer.h"
+
+namespace windep::diff {
+using nlohmann::json;
+// Image names of both compared graphs mapped to the same ids, so nodes and
+// edges are compared as integers
+class Interner {
+  std::vector<std::string> names_;
+  FlatHashMap<std::string, uint32_t, IStringHash, IStringEq> ids_;
+
+ public:
+  uint32_t Intern(const std::string& name);
+  const std::string& Name(uint32_t id) const;
+};
+
+// Flat form of the graph, loaded either from the live graph or from the
+// saved JSON output
+class Snapshot {
+  struct Edge {
+    uint32_t from;
+    uint32_t to;
+    // Sorted function names
+    std::vector<std::string> functions;
+  };
+  std::vector<uint32_t> nodes_;
+  std::vector<Edge> edges_;
+  // Index of the edge by its packed ends
+  FlatHashMap<uint64_t, size_t> edge_index_;
+  bool functions_ = false;
+  void AddEdge(uint32_t from, uint32_t to,
+               std::vector<std::string> functions);
+  friend class Differ;
+
+ public:
+  static Snapshot FromGraph(std::shared_ptr<Dependency<image::Image>> root,
+                            Interner* interner);
+  // Output of the json view, with or without functions
+  static Snapshot FromJson(const json& graph, Interner* interner);
+  // Number of the images
+  size_t Size() const { return nodes_.size(); }
+};
+
+struct FunctionChange {
+  std::string from;
+  std::string to;
+  std::string function;
+};
+
+struct Changes {
+  std::vector<std::string> nodes;
+  std::vector<std::pair<std::string, std::string>> edges;
+  std::vector<FunctionChange> functions;
+};
+
+struct Result {
+  Changes added;
+  Changes removed;
+  bool Empty() const;
+};
+
+class Differ {
+  std::shared_ptr<Interner> interner_;
+
+ public:
+  Differ();
+  Snapshot Load(std::shared_ptr<Dependency<image::Image>> root);
+  Snapshot Load(const json& graph);
+  // Loads the saved json output
+  Snapshot Load(const std::string& path);
+  // Functions are compared only if both snapshots have them
+  Result Compare(const Snapshot& before, const Snapshot& after) const;
+};
+
+// Writes the result as ascii, json or csv
+void Show(const Result& result, const std::string& format, uint8_t indent,
+          std::shared_ptr<writer::Writer> writer);
+}  // namespace windep::diff
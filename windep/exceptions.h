@@ -1,7 +1,9 @@
 // copyright MIT License Copyright (c) 2021, Albert Farrakhov
 
 #pragma once
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
 #include <exception>
 #include <string>
@@ -15,9 +17,10 @@ class WinDepException : public std::exception {
 
  public:
   explicit WinDepException(const std::string& msg) : msg_(msg) {}
-  const char* what() const override { return msg_.c_str(); }
+  const char* what() const noexcept override { return msg_.c_str(); }
 };
 
+#ifdef _WIN32
 class SeException : public WinDepException {
   unsigned int code_;
   static void __cdecl Translator(unsigned int code, PEXCEPTION_POINTERS excs) {
@@ -31,6 +34,7 @@ class SeException : public WinDepException {
   unsigned int Code() const { return code_; }
   static void SetTranslator() { _set_se_translator(&SeException::Translator); }
 };
+#endif
 
 class WinException : public WinDepException {
   using WinDepException::WinDepException;
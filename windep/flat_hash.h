@@ -0,0 +1,286 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+namespace windep {
+// Transparent hash and equality, so std::string keyed tables can be probed
+// with std::string_view or const char* without creating a temporary string
+struct StringHash {
+  size_t operator()(std::string_view text) const {
+    return static_cast<size_t>(utils::hash(text));
+  }
+};
+
+struct StringEq {
+  bool operator()(std::string_view l, std::string_view r) const {
+    return l == r;
+  }
+};
+
+// Case insensitive variants for the DLL names, which are compared without
+// creating the lowered copies
+struct IStringHash {
+  size_t operator()(std::string_view text) const {
+    return static_cast<size_t>(utils::ihash(text));
+  }
+};
+
+struct IStringEq {
+  bool operator()(std::string_view l, std::string_view r) const {
+    return utils::iequals(l, r);
+  }
+};
+
+struct PointerHash {
+  size_t operator()(const void* ptr) const {
+    // Heap pointers are aligned, mix high bits into the low ones
+    auto value = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+    value = (value ^ (value >> 33)) * 0xff51afd7ed558ccdull;
+    return static_cast<size_t>(value ^ (value >> 33));
+  }
+};
+
+template <typename T>
+struct FlatHash : std::hash<T> {};
+template <>
+struct FlatHash<std::string> : StringHash {};
+template <>
+struct FlatHash<std::string_view> : StringHash {};
+template <typename T>
+struct FlatHash<T*> : PointerHash {};
+
+template <typename T>
+struct FlatEq : std::equal_to<T> {};
+template <>
+struct FlatEq<std::string> : StringEq {};
+template <>
+struct FlatEq<std::string_view> : StringEq {};
+
+/*
+  Open addressing hash table with linear probing. Slots and their hashes are
+  stored in two flat arrays, so lookups do not chase pointers and inserts do
+  not allocate per entry. Zero hash marks an empty slot, erasing shifts the
+  following entries back instead of leaving tombstones.
+*/
+template <typename Slot, typename KeyOf, typename Hasher, typename KeyEq>
+class FlatHashTable {
+ protected:
+  std::vector<size_t> hashes_;
+  std::vector<Slot> slots_;
+  size_t size_ = 0;
+  Hasher hasher_;
+  KeyEq key_eq_;
+  static constexpr size_t kNpos = static_cast<size_t>(-1);
+  static constexpr size_t kMinCapacity = 8;
+
+  template <typename K>
+  size_t HashOf(const K& key) const {
+    const auto hash = hasher_(key);
+    return hash ? hash : 1;
+  }
+
+  template <typename K>
+  size_t FindIndex(const K& key, size_t hash) const {
+    if (!size_) return kNpos;
+    const auto mask = hashes_.size() - 1;
+    for (auto i = hash & mask; hashes_[i]; i = (i + 1) & mask) {
+      if (hashes_[i] == hash && key_eq_(KeyOf()(slots_[i]), key)) return i;
+    }
+    return kNpos;
+  }
+
+  // Returns index of the free slot for the key which is known to be absent
+  size_t FreeIndex(size_t hash) {
+    if ((size_ + 1) * 8 > hashes_.size() * 7) {
+      Rehash(hashes_.size() ? hashes_.size() * 2 : kMinCapacity);
+    }
+    const auto mask = hashes_.size() - 1;
+    auto i = hash & mask;
+    while (hashes_[i]) i = (i + 1) & mask;
+    return i;
+  }
+
+  void Rehash(size_t capacity) {
+    std::vector<size_t> hashes(capacity, 0);
+    std::vector<Slot> slots(capacity);
+    const auto mask = capacity - 1;
+    for (size_t i = 0; i < hashes_.size(); ++i) {
+      if (!hashes_[i]) continue;
+      auto j = hashes_[i] & mask;
+      while (hashes[j]) j = (j + 1) & mask;
+      hashes[j] = hashes_[i];
+      slots[j] = std::move(slots_[i]);
+    }
+    hashes_ = std::move(hashes);
+    slots_ = std::move(slots);
+  }
+
+  void EraseIndex(size_t i) {
+    const auto mask = hashes_.size() - 1;
+    for (auto j = (i + 1) & mask; hashes_[j]; j = (j + 1) & mask) {
+      // Entry at j can fill the hole only if its home is not within (i, j]
+      const auto home = hashes_[j] & mask;
+      const auto stays = i <= j ? (i < home && home <= j)
+                                : (i < home || home <= j);
+      if (!stays) {
+        hashes_[i] = hashes_[j];
+        slots_[i] = std::move(slots_[j]);
+        i = j;
+      }
+    }
+    hashes_[i] = 0;
+    slots_[i] = Slot();
+    size_--;
+  }
+
+  template <bool IsConst>
+  class Iterator {
+    using Table =
+        std::conditional_t<IsConst, const FlatHashTable, FlatHashTable>;
+    Table* table_ = nullptr;
+    size_t index_ = 0;
+    void Skip() {
+      while (index_ < table_->hashes_.size() && !table_->hashes_[index_]) {
+        index_++;
+      }
+    }
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Slot;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<IsConst, const Slot*, Slot*>;
+    using reference = std::conditional_t<IsConst, const Slot&, Slot&>;
+    Iterator() = default;
+    Iterator(Table* table, size_t index) : table_(table), index_(index) {
+      Skip();
+    }
+    template <bool OtherConst,
+              typename = std::enable_if_t<OtherConst && !IsConst>>
+    operator Iterator<OtherConst>() const {
+      return {table_, index_};
+    }
+    reference operator*() const { return table_->slots_[index_]; }
+    pointer operator->() const { return &table_->slots_[index_]; }
+    Iterator& operator++() {
+      index_++;
+      Skip();
+      return *this;
+    }
+    Iterator operator++(int) {
+      auto old = *this;
+      ++*this;
+      return old;
+    }
+    bool operator==(const Iterator& other) const {
+      return index_ == other.index_;
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+  };
+
+ public:
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+  using value_type = Slot;
+
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, hashes_.size()}; }
+  const_iterator begin() const { return {this, 0}; }
+  const_iterator end() const { return {this, hashes_.size()}; }
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+  void clear() {
+    hashes_.clear();
+    slots_.clear();
+    size_ = 0;
+  }
+  void reserve(size_t count) {
+    size_t capacity = kMinCapacity;
+    while (capacity * 7 < count * 8) capacity <<= 1;
+    if (capacity > hashes_.size()) Rehash(capacity);
+  }
+  template <typename K>
+  iterator find(const K& key) {
+    const auto index = FindIndex(key, HashOf(key));
+    return index == kNpos ? end() : iterator{this, index};
+  }
+  template <typename K>
+  const_iterator find(const K& key) const {
+    const auto index = FindIndex(key, HashOf(key));
+    return index == kNpos ? end() : const_iterator{this, index};
+  }
+  template <typename K>
+  size_t count(const K& key) const {
+    return FindIndex(key, HashOf(key)) != kNpos;
+  }
+  template <typename K>
+  size_t erase(const K& key) {
+    const auto index = FindIndex(key, HashOf(key));
+    if (index == kNpos) return 0;
+    EraseIndex(index);
+    return 1;
+  }
+  std::pair<iterator, bool> insert(Slot slot) {
+    const auto hash = HashOf(KeyOf()(slot));
+    auto index = FindIndex(KeyOf()(slot), hash);
+    if (index != kNpos) return {{this, index}, false};
+    index = FreeIndex(hash);
+    hashes_[index] = hash;
+    slots_[index] = std::move(slot);
+    size_++;
+    return {{this, index}, true};
+  }
+  template <typename... Args>
+  std::pair<iterator, bool> emplace(Args&&... args) {
+    return insert(Slot(std::forward<Args>(args)...));
+  }
+};
+
+template <typename Key, typename Value>
+struct FlatMapKeyOf {
+  const Key& operator()(const std::pair<Key, Value>& slot) const {
+    return slot.first;
+  }
+};
+
+template <typename Key>
+struct FlatSetKeyOf {
+  const Key& operator()(const Key& slot) const { return slot; }
+};
+
+template <typename Key, typename Value, typename Hasher = FlatHash<Key>,
+          typename KeyEq = FlatEq<Key>>
+class FlatHashMap
+    : public FlatHashTable<std::pair<Key, Value>, FlatMapKeyOf<Key, Value>,
+                           Hasher, KeyEq> {
+ public:
+  template <typename K>
+  Value& operator[](const K& key) {
+    const auto hash = this->HashOf(key);
+    auto index = this->FindIndex(key, hash);
+    if (index == this->kNpos) {
+      index = this->FreeIndex(hash);
+      this->hashes_[index] = hash;
+      this->slots_[index] = {Key(key), Value()};
+      this->size_++;
+    }
+    return this->slots_[index].second;
+  }
+};
+
+template <typename Key, typename Hasher = FlatHash<Key>,
+          typename KeyEq = FlatEq<Key>>
+class FlatHashSet
+    : public FlatHashTable<Key, FlatSetKeyOf<Key>, Hasher, KeyEq> {};
+}  // namespace windep
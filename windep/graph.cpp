@@ -0,0 +1,432 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#include "graph.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace windep::graph {
+Components StronglyConnected(const Adjacency& edges) {
+  constexpr auto kUnvisited = std::numeric_limits<size_t>::max();
+  const auto size = edges.Size();
+  Components result;
+  result.component.assign(size, kUnvisited);
+  std::vector<size_t> order(size, kUnvisited);
+  std::vector<size_t> low(size, 0);
+  std::vector<size_t> stack;
+  // Explicit call stack of the nodes and positions of their next edges
+  std::vector<std::pair<size_t, const size_t*>> calls;
+  size_t counter = 0;
+  for (size_t start = 0; start < size; ++start) {
+    if (order[start] != kUnvisited) continue;
+    calls.emplace_back(start, edges.Begin(start));
+    order[start] = low[start] = counter++;
+    stack.push_back(start);
+    while (calls.size()) {
+      auto& [node, next] = calls.back();
+      if (next != edges.End(node)) {
+        const auto target = *next++;
+        if (order[target] == kUnvisited) {
+          order[target] = low[target] = counter++;
+          stack.push_back(target);
+          calls.emplace_back(target, edges.Begin(target));
+        } else if (result.component[target] == kUnvisited) {
+          // Target is still on the stack, i.e. in the current path
+          low[node] = std::min(low[node], order[target]);
+        }
+        continue;
+      }
+      const auto finished = node;
+      calls.pop_back();
+      if (calls.size()) {
+        auto& parent = calls.back().first;
+        low[parent] = std::min(low[parent], low[finished]);
+      }
+      if (low[finished] == order[finished]) {
+        const auto id = result.members.size();
+        auto& members = result.members.emplace_back();
+        size_t member;
+        do {
+          member = stack.back();
+          stack.pop_back();
+          result.component[member] = id;
+          members.push_back(member);
+        } while (member != finished);
+        std::sort(members.begin(), members.end());
+      }
+    }
+  }
+  std::vector<size_t> targets;
+  for (const auto& members : result.members) {
+    targets.clear();
+    for (const auto node : members) {
+      for (auto it = edges.Begin(node); it != edges.End(node); ++it) {
+        const auto target = result.component[*it];
+        if (target != result.component[node]) targets.push_back(target);
+      }
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    result.dag.targets.insert(result.dag.targets.end(), targets.begin(),
+                              targets.end());
+    result.dag.offsets.push_back(result.dag.targets.size());
+  }
+  return result;
+}
+
+Adjacency Reverse(const Adjacency& edges) {
+  const auto size = edges.Size();
+  Adjacency reversed;
+  reversed.offsets.assign(size + 1, 0);
+  for (const auto target : edges.targets) reversed.offsets[target + 1]++;
+  for (size_t node = 0; node < size; ++node) {
+    reversed.offsets[node + 1] += reversed.offsets[node];
+  }
+  reversed.targets.resize(edges.targets.size());
+  auto next = reversed.offsets;
+  for (size_t node = 0; node < size; ++node) {
+    for (auto it = edges.Begin(node); it != edges.End(node); ++it) {
+      reversed.targets[next[*it]++] = node;
+    }
+  }
+  return reversed;
+}
+
+std::vector<size_t> ComponentDepths(const Components& components) {
+  const auto& dag = components.dag;
+  std::vector<size_t> depths(dag.Size(), 0);
+  // Targets always have the lower ids, so they are ready before the sources
+  for (size_t id = 0; id < dag.Size(); ++id) {
+    for (auto it = dag.Begin(id); it != dag.End(id); ++it) {
+      depths[id] = std::max(depths[id], depths[*it] + 1);
+    }
+  }
+  return depths;
+}
+
+std::vector<size_t> TopologicalOrder(const Components& components,
+                                     const std::vector<size_t>& depths) {
+  // Counting sort of the components by depth keeps the id order stable
+  const auto levels =
+      depths.empty() ? 0 : *std::max_element(depths.begin(), depths.end()) + 1;
+  std::vector<size_t> starts(levels + 1, 0);
+  for (const auto depth : depths) starts[depth + 1]++;
+  for (size_t level = 0; level < levels; ++level) {
+    starts[level + 1] += starts[level];
+  }
+  std::vector<size_t> sorted(depths.size());
+  for (size_t id = 0; id < depths.size(); ++id) {
+    sorted[starts[depths[id]]++] = id;
+  }
+  std::vector<size_t> order;
+  order.reserve(components.component.size());
+  for (const auto id : sorted) {
+    const auto& members = components.members[id];
+    order.insert(order.end(), members.rbegin(), members.rend());
+  }
+  return order;
+}
+
+std::vector<size_t> ImmediateDominators(const Adjacency& edges, size_t root) {
+  const auto size = edges.Size();
+  // Iterative DFS numbering the nodes in the postorder
+  std::vector<size_t> postorder(size, kNoNode);
+  std::vector<size_t> reverse_postorder;
+  std::vector<bool> visited(size, false);
+  std::vector<std::pair<size_t, const size_t*>> calls{
+      {root, edges.Begin(root)}};
+  visited[root] = true;
+  while (calls.size()) {
+    auto& [node, next] = calls.back();
+    if (next != edges.End(node)) {
+      const auto target = *next++;
+      if (!visited[target]) {
+        visited[target] = true;
+        calls.emplace_back(target, edges.Begin(target));
+      }
+      continue;
+    }
+    postorder[node] = reverse_postorder.size();
+    reverse_postorder.push_back(node);
+    calls.pop_back();
+  }
+  std::reverse(reverse_postorder.begin(), reverse_postorder.end());
+
+  const auto preds = Reverse(edges);
+  std::vector<size_t> idoms(size, kNoNode);
+  idoms[root] = root;
+  const auto intersect = [&](size_t l, size_t r) {
+    while (l != r) {
+      while (postorder[l] < postorder[r]) l = idoms[l];
+      while (postorder[r] < postorder[l]) r = idoms[r];
+    }
+    return l;
+  };
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (const auto node : reverse_postorder) {
+      if (node == root) continue;
+      auto idom = kNoNode;
+      for (auto it = preds.Begin(node); it != preds.End(node); ++it) {
+        if (idoms[*it] == kNoNode) continue;
+        idom = idom == kNoNode ? *it : intersect(*it, idom);
+      }
+      if (idoms[node] != idom) {
+        idoms[node] = idom;
+        changed = true;
+      }
+    }
+  }
+  return idoms;
+}
+
+std::vector<size_t> DominatorChain(const std::vector<size_t>& idoms,
+                                   size_t node) {
+  std::vector<size_t> chain;
+  if (idoms[node] == kNoNode) return chain;
+  while (idoms[node] != node) {
+    node = idoms[node];
+    chain.push_back(node);
+  }
+  std::reverse(chain.begin(), chain.end());
+  return chain;
+}
+
+std::vector<Bitset::Run> Bitset::Runs() const {
+  if (!dense_) return runs_;
+  std::vector<Run> runs;
+  ForEach([&runs](size_t bit) {
+    const auto at = static_cast<uint32_t>(bit);
+    if (runs.size() && runs.back().second == at) {
+      ++runs.back().second;
+    } else {
+      runs.emplace_back(at, at + 1);
+    }
+  });
+  return runs;
+}
+
+std::vector<uint64_t> Bitset::Words() const {
+  if (dense_) {
+    auto words = words_;
+    words.resize(WordCount());
+    return words;
+  }
+  std::vector<uint64_t> words(WordCount(), 0);
+  for (const auto& [begin, end] : runs_) {
+    for (auto bit = begin; bit < end; ++bit) {
+      words[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+  }
+  return words;
+}
+
+void Bitset::Assign(std::vector<Run> runs) {
+  if (runs.size() > WordCount()) {
+    runs_ = std::move(runs);
+    dense_ = false;
+    Assign(Words());
+    return;
+  }
+  runs_ = std::move(runs);
+  words_.clear();
+  dense_ = false;
+}
+
+void Bitset::Assign(std::vector<uint64_t> words) {
+  words_ = std::move(words);
+  runs_.clear();
+  dense_ = true;
+  // Runs start at the set bits, which follow the clear ones
+  size_t runs = 0;
+  uint64_t carry = 0;
+  for (const auto bits : words_) {
+    runs += PopCount(bits & ~(bits << 1 | carry));
+    carry = bits >> 63;
+  }
+  if (runs <= WordCount()) {
+    auto sparse = Runs();
+    words_.clear();
+    runs_ = std::move(sparse);
+    dense_ = false;
+  }
+}
+
+size_t Bitset::PopCount(uint64_t bits) {
+  bits -= (bits >> 1) & 0x5555555555555555ull;
+  bits =
+      (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+  bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return static_cast<size_t>((bits * 0x0101010101010101ull) >> 56);
+}
+
+void Bitset::Set(size_t bit) {
+  size_ = std::max(size_, bit + 1);
+  const auto at = static_cast<uint32_t>(bit);
+  Bitset single{size_};
+  single.runs_.emplace_back(at, at + 1);
+  *this |= single;
+}
+
+bool Bitset::Test(size_t bit) const {
+  if (bit >= size_) return false;
+  if (dense_) return (words_[bit / 64] >> (bit % 64) & 1) != 0;
+  // First run, which begins after the bit, follows the only candidate
+  auto run_it = std::upper_bound(
+      runs_.begin(), runs_.end(), bit,
+      [](size_t value, const Run& run) { return value < run.first; });
+  return run_it != runs_.begin() && bit < std::prev(run_it)->second;
+}
+
+size_t Bitset::Count() const {
+  size_t count = 0;
+  if (dense_) {
+    for (const auto bits : words_) count += PopCount(bits);
+  } else {
+    for (const auto& [begin, end] : runs_) count += end - begin;
+  }
+  return count;
+}
+
+size_t Bitset::Memory() const {
+  return dense_ ? words_.size() * sizeof(uint64_t)
+                : runs_.size() * sizeof(Run);
+}
+
+Bitset& Bitset::operator|=(const Bitset& other) {
+  size_ = std::max(size_, other.size_);
+  if (dense_ || other.dense_) {
+    auto words = Words();
+    const auto other_words = other.Words();
+    for (size_t i = 0; i < other_words.size(); ++i) words[i] |= other_words[i];
+    Assign(std::move(words));
+    return *this;
+  }
+  std::vector<Run> runs;
+  runs.reserve(runs_.size() + other.runs_.size());
+  std::merge(runs_.begin(), runs_.end(), other.runs_.begin(),
+             other.runs_.end(), std::back_inserter(runs));
+  // Overlapping and adjacent runs are joined
+  size_t joined = 0;
+  for (size_t i = 1; i < runs.size(); ++i) {
+    if (runs[i].first <= runs[joined].second) {
+      runs[joined].second = std::max(runs[joined].second, runs[i].second);
+    } else {
+      runs[++joined] = runs[i];
+    }
+  }
+  if (runs.size()) runs.resize(joined + 1);
+  Assign(std::move(runs));
+  return *this;
+}
+
+Bitset& Bitset::operator&=(const Bitset& other) {
+  if (dense_ || other.dense_) {
+    auto words = Words();
+    const auto other_words = other.Words();
+    for (size_t i = 0; i < words.size(); ++i) {
+      words[i] &= i < other_words.size() ? other_words[i] : 0;
+    }
+    Assign(std::move(words));
+    return *this;
+  }
+  std::vector<Run> runs;
+  auto l = runs_.begin();
+  auto r = other.runs_.begin();
+  while (l != runs_.end() && r != other.runs_.end()) {
+    const auto begin = std::max(l->first, r->first);
+    const auto end = std::min(l->second, r->second);
+    if (begin < end) runs.emplace_back(begin, end);
+    // Run, which ends first, can't overlap the next runs of the other
+    if (l->second < r->second) {
+      ++l;
+    } else {
+      ++r;
+    }
+  }
+  Assign(std::move(runs));
+  return *this;
+}
+
+Bitset& Bitset::operator-=(const Bitset& other) {
+  if (dense_ || other.dense_) {
+    auto words = Words();
+    const auto other_words = other.Words();
+    const auto size = std::min(words.size(), other_words.size());
+    for (size_t i = 0; i < size; ++i) words[i] &= ~other_words[i];
+    Assign(std::move(words));
+    return *this;
+  }
+  std::vector<Run> runs;
+  auto r = other.runs_.begin();
+  for (auto [begin, end] : runs_) {
+    // Runs of the other, which end before the run, are passed
+    while (r != other.runs_.end() && r->second <= begin) ++r;
+    for (auto cut = r; cut != other.runs_.end() && cut->first < end; ++cut) {
+      if (cut->first > begin) runs.emplace_back(begin, cut->first);
+      begin = std::max(begin, cut->second);
+    }
+    if (begin < end) runs.emplace_back(begin, end);
+  }
+  Assign(std::move(runs));
+  return *this;
+}
+
+size_t Bitset::CountTrailingZeros(uint64_t bits) {
+  // De Bruijn multiplication of the lowest set bit
+  static constexpr uint8_t kPositions[64] = {
+      0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+      62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+      63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+      46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6,
+  };
+  const auto lowest = bits & (~bits + 1);
+  return kPositions[(lowest * 0x03f79d71b4cb0a89ull) >> 58];
+}
+
+Reachability::Reachability(const Components& components)
+    : component_(components.component), members_(components.members) {
+  const auto& dag = components.dag;
+  const auto size = dag.Size();
+  closures_.reserve(size);
+  sizes_.reserve(size);
+  for (size_t id = 0; id < size; ++id) {
+    // Imported components have the lower ids and are ready
+    Bitset closure{id + 1};
+    closure.Set(id);
+    for (auto it = dag.Begin(id); it != dag.End(id); ++it) {
+      closure |= closures_[*it];
+    }
+    size_t closure_size = 0;
+    closure.ForEach([&](size_t member) {
+      closure_size += members_[member].size();
+    });
+    closures_.push_back(std::move(closure));
+    sizes_.push_back(closure_size);
+  }
+}
+
+bool Reachability::Reaches(size_t from, size_t to) const {
+  return closures_[component_[from]].Test(component_[to]);
+}
+
+size_t Reachability::ClosureSize(size_t node) const {
+  return sizes_[component_[node]];
+}
+
+const Bitset& Reachability::Closure(size_t node) const {
+  return closures_[component_[node]];
+}
+
+std::vector<size_t> Reachability::Nodes(const Bitset& closure) const {
+  std::vector<size_t> nodes;
+  closure.ForEach([&](size_t id) {
+    nodes.insert(nodes.end(), members_[id].begin(), members_[id].end());
+  });
+  std::sort(nodes.begin(), nodes.end());
+  return nodes;
+}
+}  // namespace windep::graph
@@ -0,0 +1,188 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "dependency.h"
+#include "flat_hash.h"
+
+namespace windep::graph {
+// Compressed sparse rows: targets of the node i are
+// targets[offsets[i]..offsets[i + 1])
+struct Adjacency {
+  std::vector<size_t> offsets{0};
+  std::vector<size_t> targets;
+  size_t Size() const { return offsets.size() - 1; }
+  const size_t* Begin(size_t node) const {
+    return targets.data() + offsets[node];
+  }
+  const size_t* End(size_t node) const {
+    return targets.data() + offsets[node + 1];
+  }
+};
+
+/*
+  Dependency graph flattened into the index based adjacency, so the graph
+  algorithms work over plain arrays without recursion and pointer chasing.
+  Root has index 0, children of every node are sorted, so the indices and
+  all results built on them do not depend on the hash order.
+*/
+template <typename T>
+class IndexedGraph {
+  std::vector<std::shared_ptr<Dependency<T>>> nodes_;
+  Adjacency edges_;
+
+ public:
+  explicit IndexedGraph(std::shared_ptr<Dependency<T>> root)
+      : IndexedGraph(std::vector<std::shared_ptr<Dependency<T>>>{root}) {}
+  // Roots get the first indices in the given order, shared nodes are merged
+  explicit IndexedGraph(
+      const std::vector<std::shared_ptr<Dependency<T>>>& roots) {
+    FlatHashMap<const Dependency<T>*, size_t> index;
+    for (const auto& root : roots) {
+      if (index.emplace(root.get(), nodes_.size()).second) {
+        nodes_.push_back(root);
+      }
+    }
+    std::vector<std::shared_ptr<Dependency<T>>> children;
+    // Breadth first discovery, nodes are processed in the index order
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      const auto& children_set = nodes_[i]->Children();
+      children.assign(children_set.begin(), children_set.end());
+      std::sort(children.begin(), children.end(),
+                [](const auto& l, const auto& r) { return *l < *r; });
+      for (auto& child : children) {
+        const auto [index_it, inserted] =
+            index.emplace(child.get(), nodes_.size());
+        if (inserted) nodes_.push_back(child);
+        edges_.targets.push_back(index_it->second);
+      }
+      edges_.offsets.push_back(edges_.targets.size());
+    }
+  }
+  size_t Size() const { return nodes_.size(); }
+  const std::shared_ptr<Dependency<T>>& Node(size_t index) const {
+    return nodes_[index];
+  }
+  const Adjacency& Edges() const { return edges_; }
+};
+
+struct Components {
+  // Component of every node
+  std::vector<size_t> component;
+  // Nodes of every component in the ascending order
+  std::vector<std::vector<size_t>> members;
+  // Condensed acyclic graph between the components without duplicates
+  Adjacency dag;
+};
+
+// Iterative Tarjan algorithm, O(V + E). Components are numbered in the
+// reverse topological order: every component depends only on the lower ids.
+Components StronglyConnected(const Adjacency& edges);
+
+// Length of the longest chain of components below every component, leaves
+// have zero depth
+std::vector<size_t> ComponentDepths(const Components& components);
+
+// Nodes ordered leaves first, O(V + E). Components go by depth and then by
+// id, members of a cycle go from the farthest from the root.
+std::vector<size_t> TopologicalOrder(const Components& components,
+                                     const std::vector<size_t>& depths);
+
+constexpr size_t kNoNode = static_cast<size_t>(-1);
+
+Adjacency Reverse(const Adjacency& edges);
+
+// Immediate dominator of every node, i.e. the closest node which is on every
+// path from the root. Root refers to itself, unreachable nodes to kNoNode.
+// Cooper, Harvey and Kennedy iterative algorithm over the reverse postorder,
+// which converges in a few passes on the real graphs.
+std::vector<size_t> ImmediateDominators(const Adjacency& edges,
+                                        size_t root = 0);
+
+// All dominators of the node from the root down to the immediate one
+std::vector<size_t> DominatorChain(const std::vector<size_t>& idoms,
+                                   size_t node);
+
+/*
+  Set of the component ids. Components are numbered by the depth first
+  search, so the closure of a component is mostly one run of the ids found
+  under it and a few runs of the ones found before. Bits are stored as the
+  sorted runs, and as the plain words only if the runs take more memory.
+*/
+class Bitset {
+  using Run = std::pair<uint32_t, uint32_t>;
+
+  size_t size_ = 0;
+  bool dense_ = false;
+  // Disjoint [begin, end) runs of the set bits in the ascending order
+  std::vector<Run> runs_;
+  std::vector<uint64_t> words_;
+
+  size_t WordCount() const { return (size_ + 63) / 64; }
+  std::vector<Run> Runs() const;
+  std::vector<uint64_t> Words() const;
+  // Keeps the representation, which takes less memory
+  void Assign(std::vector<Run> runs);
+  void Assign(std::vector<uint64_t> words);
+  static size_t PopCount(uint64_t bits);
+
+ public:
+  explicit Bitset(size_t size = 0) : size_(size) {}
+  void Set(size_t bit);
+  bool Test(size_t bit) const;
+  size_t Count() const;
+  // Bytes taken by the bits
+  size_t Memory() const;
+  Bitset& operator|=(const Bitset& other);
+  Bitset& operator&=(const Bitset& other);
+  // Clears the bits, which are set in the other
+  Bitset& operator-=(const Bitset& other);
+  bool operator==(const Bitset& other) const { return Runs() == other.Runs(); }
+  template <typename Function>
+  void ForEach(Function function) const {
+    if (!dense_) {
+      for (const auto& [begin, end] : runs_) {
+        for (auto bit = begin; bit < end; ++bit) function(size_t{bit});
+      }
+      return;
+    }
+    for (size_t word = 0; word < words_.size(); ++word) {
+      for (auto bits = words_[word]; bits; bits &= bits - 1) {
+        function(word * 64 + CountTrailingZeros(bits));
+      }
+    }
+  }
+  static size_t CountTrailingZeros(uint64_t bits);
+};
+
+/*
+  Transitive closures of all nodes. Nodes of one component share the
+  closure, so only one bitset per component is stored and its bits are the
+  components too. Closures are built once from the leaves, every component
+  merges the ready closures of the components it imports.
+*/
+class Reachability {
+  std::vector<size_t> component_;
+  std::vector<std::vector<size_t>> members_;
+  std::vector<Bitset> closures_;
+  // Number of nodes in the closure of every component
+  std::vector<size_t> sizes_;
+
+ public:
+  explicit Reachability(const Components& components);
+  // Whether the node depends on the other one, including itself, by the
+  // binary search over the runs of its closure
+  bool Reaches(size_t from, size_t to) const;
+  // Number of nodes reachable from the node, including itself
+  size_t ClosureSize(size_t node) const;
+  // Closure as the bitset of components for the set algebra
+  const Bitset& Closure(size_t node) const;
+  // Nodes of the components closure in the ascending order
+  std::vector<size_t> Nodes(const Bitset& closure) const;
+};
+}  // namespace windep::graph
@@ -2,30 +2,51 @@
 
 #include "image.h"
 
+#include <algorithm>
+#include <deque>
+#include <exception>
 #include <iostream>
+#include <map>
 #include <memory>
-#include <sstream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "exceptions.h"
 
 namespace windep::image {
+const char* KindName(ImportKind kind) {
+  switch (kind) {
+    case ImportKind::kStatic:
+      return "static";
+    case ImportKind::kDelayed:
+      return "delayed";
+    case ImportKind::kForwarded:
+      return "forwarded";
+  }
+  return "";
+}
+
+bool Function::IsUnresolved() const { return unresolved_; }
+
+void Function::SetUnresolved(bool enable) { unresolved_ = enable; }
+
+bool Function::HasKind(ImportKind kind) const { return (kinds_ & kind) != 0; }
+
+void Function::Merge(std::shared_ptr<Context> other) {
+  kinds_ |= std::dynamic_pointer_cast<Function>(other)->kinds_;
+}
+
 Image::Image(const std::string& name) : name_(name) {}
 
 std::string Image::String() const { return Name(); }
 
 void Image::Merge(std::shared_ptr<Context> other) {
   auto image = std::dynamic_pointer_cast<Image>(other);
-  auto& imports = Imports();
   for (const auto& other_import : image->Imports()) {
-    auto import = imports.find(other_import);
-    if (import != imports.end()) {
-      (*import)->Merge(other_import);
-    } else {
-      AddImport(other_import);
-    }
+    AddImport(other_import);
   }
 }
 
@@ -33,8 +54,15 @@ const std::string& Image::Name() const { return name_; }
 
 const Image::ImportsCollection& Image::Imports() const { return imports_; }
 
+bool Image::HasExport(const std::string& function) const { return true; }
+
 void Image::AddImport(std::shared_ptr<Import> import) {
-  imports_.insert(import);
+  auto old_import = imports_.find(import);
+  if (old_import != imports_.end()) {
+    (*old_import)->Merge(import);
+  } else {
+    imports_.insert(import);
+  }
 }
 
 void Image::ClearImports() { imports_.clear(); }
@@ -43,6 +71,58 @@ const std::filesystem::path& Image::Path() const { return path_; }
 
 void Image::SetPath(const std::wstring& path) { path_ = path; }
 
+void ImageContextFactory::Prefetch(const std::vector<std::string>& images) {}
+
+CachingImageFactory::CachingImageFactory(
+    std::shared_ptr<ImageContextFactory> image_factory)
+    : image_factory_(std::move(image_factory)) {}
+
+std::shared_ptr<Image> CachingImageFactory::Create(const std::string& image) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto image_it = images_.find(image);
+    if (image_it != images_.end()) {
+      if (!image_it->second) {
+        throw exc::NotFound("Cannot open '" + image + "' image");
+      }
+      return image_it->second;
+    }
+  }
+  // Images are parsed unlocked, so the different images are parsed
+  // concurrently
+  try {
+    auto image_ctx = image_factory_->Create(image);
+    std::lock_guard<std::mutex> lock(mutex_);
+    images_[image] = image_ctx;
+    return image_ctx;
+  } catch (const exc::WinDepException&) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    images_[image] = nullptr;
+    throw;
+  }
+}
+
+void CachingImageFactory::Prefetch(const std::vector<std::string>& images) {
+  std::vector<std::string> missing;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& image : images) {
+      if (!images_.count(image)) missing.push_back(image);
+    }
+  }
+  if (missing.size()) image_factory_->Prefetch(missing);
+}
+
+size_t CachingImageFactory::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return images_.size();
+}
+
+void CachingImageFactory::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  images_.clear();
+}
+
 std::shared_ptr<Dependency<Image>> ImageDependencyFactory::CreateRecursive(
     const std::string& image, std::shared_ptr<Dependency<Image>> parent) {
   auto dependency = std::make_shared<Dependency<Image>>();
@@ -50,17 +130,24 @@ std::shared_ptr<Dependency<Image>> ImageDependencyFactory::CreateRecursive(
   dependency->SetContext(image_ctx);
   dependency->AppendParent(parent);
   visited_[image] = dependency;
+  // Unvisited imports are read ahead while the first of them is parsed
+  std::vector<std::string> frontier;
+  for (const auto& import : image_ctx->Imports()) {
+    if (!visited_.count(import->Name())) frontier.push_back(import->Name());
+  }
+  if (frontier.size()) image_factory_->Prefetch(frontier);
   for (auto import : image_ctx->Imports()) {
     try {
+      std::shared_ptr<Dependency<Image>> child;
       auto child_dep = visited_.find(import->Name());
       if (child_dep == visited_.end()) {
-        auto child = CreateRecursive(import->Name(), dependency);
-        child->AppendParent(dependency);
-        dependency->AppendChild(child);
+        child = CreateRecursive(import->Name(), dependency);
       } else {
-        child_dep->second->AppendParent(dependency);
-        dependency->AppendChild(child_dep->second);
+        child = child_dep->second;
       }
+      child->AppendParent(dependency);
+      dependency->AppendChild(child);
+      VerifyBindings(*import, *child->GetContext());
     } catch (exc::WinDepException) {
       import->SetUnresolved(true);
     }
@@ -68,88 +155,445 @@ std::shared_ptr<Dependency<Image>> ImageDependencyFactory::CreateRecursive(
   return dependency;
 }
 
+void ImageDependencyFactory::VerifyBindings(const Import& import,
+                                            const Image& image) {
+  for (const auto& func : import.Functions()) {
+    func->SetUnresolved(!image.HasExport(func->Name()));
+  }
+}
+
 ImageDependencyFactory::ImageDependencyFactory(
     const std::string& root, std::shared_ptr<ImageContextFactory> image_factory)
     : root_(root), image_factory_(std::move(image_factory)) {}
 
 std::shared_ptr<Dependency<Image>> ImageDependencyFactory::Create() {
-  return CreateRecursive(root_);
+  return Create(root_);
+}
+
+std::shared_ptr<Dependency<Image>> ImageDependencyFactory::Create(
+    const std::string& root) {
+  auto root_it = visited_.find(root);
+  return root_it == visited_.end() ? CreateRecursive(root) : root_it->second;
+}
+
+PipelineDependencyFactory::PipelineDependencyFactory(
+    const std::string& root, std::shared_ptr<ImageContextFactory> image_factory,
+    std::shared_ptr<TreeVisitor<Image>> visitor, size_t threads)
+    : root_(root),
+      image_factory_(std::move(image_factory)),
+      visitor_(std::move(visitor)),
+      threads_(threads ? threads
+                       : std::max<size_t>(std::thread::hardware_concurrency(),
+                                          1)) {}
+
+void PipelineDependencyFactory::Parse() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_.wait(lock, [this] { return stop_ || pending_.size(); });
+    if (stop_) return;
+    Parsed parsed;
+    parsed.name = std::move(pending_.front());
+    pending_.pop_front();
+    lock.unlock();
+    try {
+      parsed.image = image_factory_->Create(parsed.name);
+    } catch (...) {
+      parsed.error = std::current_exception();
+    }
+    lock.lock();
+    drained_.wait(lock, [this] { return stop_ || done_.size() < kQueueSize; });
+    if (stop_) return;
+    done_.push_back(std::move(parsed));
+    parsed_.notify_one();
+  }
+}
+
+void PipelineDependencyFactory::Schedule(const std::string& image) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(image);
+  }
+  queued_.notify_one();
+}
+
+PipelineDependencyFactory::Parsed PipelineDependencyFactory::Take() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  parsed_.wait(lock, [this] { return done_.size(); });
+  auto parsed = std::move(done_.front());
+  done_.pop_front();
+  lock.unlock();
+  drained_.notify_one();
+  return parsed;
+}
+
+std::shared_ptr<Dependency<Image>> PipelineDependencyFactory::Create() {
+  struct Node {
+    std::shared_ptr<Dependency<Image>> dependency;
+    size_t height = 0;
+    // Imports, which are not parsed yet
+    size_t waiting = 0;
+    bool failed = false;
+    // Importers waiting for the image with their imports of it
+    std::vector<std::pair<size_t, std::shared_ptr<Import>>> importers;
+  };
+  // Nodes by the discovery index, references are stable while it grows
+  std::deque<Node> nodes;
+  FlatHashMap<std::string, size_t, IStringHash, IStringEq> ids;
+  size_t in_flight = 0;
+  const auto discover = [&](const std::string& image, size_t height) {
+    const auto id = nodes.size();
+    ids.emplace(image, id);
+    nodes.emplace_back().height = height;
+    Schedule(image);
+    ++in_flight;
+    return id;
+  };
+  const auto link = [](Node* importer, const Node& imported, Import* import) {
+    importer->dependency->AppendChild(imported.dependency);
+    imported.dependency->AppendParent(importer->dependency);
+    ImageDependencyFactory::VerifyBindings(*import,
+                                           *imported.dependency->GetContext());
+  };
+  const auto resolve = [&](Node* node) {
+    if (!--node->waiting && visitor_) {
+      visitor_->Visit(node->dependency, node->height);
+    }
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+  }
+  std::vector<std::thread> parsers;
+  for (size_t i = 0; i < threads_; ++i) {
+    parsers.emplace_back(&PipelineDependencyFactory::Parse, this);
+  }
+  // Parsers are stopped on any error, the root and the unexpected errors are
+  // thrown after that
+  std::exception_ptr error;
+  try {
+    discover(root_, 0);
+    while (in_flight) {
+      auto parsed = Take();
+      --in_flight;
+      const auto id = ids.find(parsed.name)->second;
+      auto& node = nodes[id];
+      if (parsed.error) {
+        try {
+          std::rethrow_exception(parsed.error);
+        } catch (const exc::WinDepException&) {
+          if (!id) throw;
+        }
+        // Image, which can't be opened, is an unresolved import
+        node.failed = true;
+        for (auto& [importer, import] : node.importers) {
+          import->SetUnresolved(true);
+          resolve(&nodes[importer]);
+        }
+        node.importers.clear();
+        continue;
+      }
+      node.dependency = std::make_shared<Dependency<Image>>();
+      node.dependency->SetContext(parsed.image);
+      for (const auto& import : parsed.image->Imports()) {
+        auto id_it = ids.find(import->Name());
+        const auto child_id = id_it == ids.end()
+                                  ? discover(import->Name(), node.height + 1)
+                                  : id_it->second;
+        auto& child = nodes[child_id];
+        if (child.dependency) {
+          link(&node, child, import.get());
+        } else if (child.failed) {
+          import->SetUnresolved(true);
+        } else {
+          child.importers.emplace_back(id, import);
+          ++node.waiting;
+        }
+      }
+      for (auto& [importer, import] : node.importers) {
+        link(&nodes[importer], node, import.get());
+        resolve(&nodes[importer]);
+      }
+      node.importers.clear();
+      // Node is visited with its last parsed import or right away
+      ++node.waiting;
+      resolve(&node);
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    pending_.clear();
+    done_.clear();
+  }
+  queued_.notify_all();
+  drained_.notify_all();
+  for (auto& parser : parsers) parser.join();
+  if (error) std::rethrow_exception(error);
+  return nodes.front().dependency;
+}
+
+ParallelTreeVisitor::ParallelTreeVisitor(
+    std::shared_ptr<writer::Writer> writer, size_t batch_size,
+    size_t min_chunk_size)
+    : writer_(std::move(writer)),
+      batch_size_(batch_size),
+      min_chunk_size_(min_chunk_size) {}
+
+void ParallelTreeVisitor::Register(const Dependency<Image>& node) {}
+
+std::string ParallelTreeVisitor::Header() const { return ""; }
+
+std::string ParallelTreeVisitor::Footer() const { return ""; }
+
+void ParallelTreeVisitor::Visit(std::shared_ptr<Dependency<Image>> node,
+                                size_t height) {
+  Register(*node);
+  nodes_.emplace_back(std::move(node), height);
+  if (nodes_.size() == batch_size_) WriteBatch();
+}
+
+void ParallelTreeVisitor::Finish() {
+  WriteBatch();
+  const auto footer = Footer();
+  if (footer.size()) writer_->Write(footer);
+}
+
+void ParallelTreeVisitor::WriteBatch() {
+  if (!opened_) {
+    const auto header = Header();
+    if (header.size()) writer_->Write(header);
+    opened_ = true;
+  }
+  if (nodes_.empty()) return;
+  const size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+  const auto workers = std::min<size_t>(
+      threads, (nodes_.size() + min_chunk_size_ - 1) / min_chunk_size_);
+  const auto chunk_size = (nodes_.size() + workers - 1) / workers;
+  std::vector<std::string> chunks(workers);
+  const auto format_chunk = [this, chunk_size, &chunks](size_t chunk) {
+    const auto end = std::min(nodes_.size(), (chunk + 1) * chunk_size);
+    for (auto i = chunk * chunk_size; i < end; ++i) {
+      Format(*nodes_[i].first, nodes_[i].second, &chunks[chunk]);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t chunk = 1; chunk < workers; ++chunk) {
+    pool.emplace_back(format_chunk, chunk);
+  }
+  format_chunk(0);
+  for (auto& worker : pool) worker.join();
+  nodes_.clear();
+  for (const auto& chunk : chunks) {
+    if (chunk.size()) writer_->Write(chunk);
+  }
+  writer_->Flush();
 }
 
 AsciiTreeVisitor::AsciiTreeVisitor(std::shared_ptr<writer::Writer> writer,
-                                   bool functions, uint8_t indent)
-    : writer_(writer), functions_(functions), indent_(indent) {}
-
-void AsciiTreeVisitor::Visit(std::shared_ptr<Dependency<Image>> node,
-                             size_t height) {
-  std::string offset(height * indent_, ' ');
-  std::stringstream output;
-  output << offset << node->GetContext()->String() << std::endl;
-  if (functions_) {
-    for (const auto& import : node->GetContext()->Imports()) {
-      for (const auto& func : import->Functions()) {
-        output << offset << "- " << func->String() << std::endl;
+                                   bool functions, uint8_t indent,
+                                   size_t batch_size, size_t min_chunk_size)
+    : ParallelTreeVisitor(std::move(writer), batch_size, min_chunk_size),
+      functions_(functions),
+      indent_(indent) {}
+
+void AsciiTreeVisitor::Format(const Dependency<Image>& node, size_t height,
+                              std::string* output) const {
+  const std::string offset(height * indent_, ' ');
+  *output += offset + node.GetContext()->String() + '\n';
+  for (const auto& import : node.GetContext()->Imports()) {
+    for (const auto& func : import->Functions()) {
+      // Missing functions are shown even if the functions output is disabled
+      if (func->IsUnresolved()) {
+        *output += offset + "- " + func->String() + " (missing)\n";
+      } else if (functions_) {
+        *output += offset + "- " + func->String() + '\n';
       }
     }
   }
-  writer_->Write(output);
 }
 
 JsonTreeVisitor::JsonTreeVisitor(bool functions) : functions_(functions) {}
 
-void JsonTreeVisitor::Visit(std::shared_ptr<Dependency<Image>> node,
-                            size_t height) {
-  auto img = node->GetContext();
-  json img_json = {{"path", img->Path().u8string()}, {"imports", json({})}};
-  for (auto import : img->Imports()) {
+namespace {
+json ImportsJson(const Image& img, bool functions) {
+  json imports_json = json::object();
+  for (auto import : img.Imports()) {
+    std::vector<std::string> kinds;
+    for (auto kind : {ImportKind::kStatic, ImportKind::kDelayed,
+                      ImportKind::kForwarded}) {
+      if (import->HasKind(kind)) kinds.push_back(KindName(kind));
+    }
+    std::vector<std::string> missing;
+    for (auto func : import->Functions()) {
+      if (func->IsUnresolved()) missing.push_back(func->Name());
+    }
     json import_json = {{"alias", import->Alias()},
+                        {"kinds", std::move(kinds)},
+                        {"missing", std::move(missing)},
                         {"unresolved", import->IsUnresolved()}};
-    if (functions_) {
-      std::vector<std::string> functions;
-      functions.reserve(import->Functions().size());
-      for (auto func : import->Functions()) functions.push_back(func->Name());
-      import_json["functions"] = std::move(functions);
+    if (functions) {
+      std::vector<std::string> names;
+      names.reserve(import->Functions().size());
+      for (auto func : import->Functions()) names.push_back(func->Name());
+      import_json["functions"] = std::move(names);
     }
-    img_json["imports"][import->Name()] = std::move(import_json);
+    imports_json[import->Name()] = std::move(import_json);
   }
-  json_[img->Name()] = std::move(img_json);
+  return imports_json;
+}
+}  // namespace
+
+void JsonTreeVisitor::Visit(std::shared_ptr<Dependency<Image>> node,
+                            size_t height) {
+  auto img = node->GetContext();
+  json_[img->Name()] = {{"path", img->Path().u8string()},
+                        {"imports", ImportsJson(*img, functions_)}};
 }
 
 json& JsonTreeVisitor::Json() { return json_; }
 
-void DotTreeVisitor::Visit(std::shared_ptr<Dependency<Image>> node,
-                           size_t height) {
+void DotTreeVisitor::Format(const Dependency<Image>& node, size_t height,
+                            std::string* output) const {
   std::string offset(indent_, ' ');
-  std::string stmt = offset + FormatId(node->GetContext()) + " -> {";
-  for (auto import : node->GetContext()->Imports()) {
-    stmt += FormatId(import) + ",";
+  // Targets grouped by the edge attributes, plain edges go first
+  std::map<std::string, std::string> targets{{"", ""}};
+  for (auto import : node.GetContext()->Imports()) {
+    targets[FormatAttributes(*import)] += FormatId(import) + ",";
+  }
+  for (auto& [attributes, ids] : targets) {
+    if (ids.size()) ids.pop_back();
+    if (attributes.size() && ids.empty()) continue;
+    *output += offset + FormatId(node.GetContext()) + " -> {" + ids + "}";
+    if (attributes.size()) *output += " [" + attributes + "]";
+    *output += "\n";
+  }
+}
+
+std::string DotTreeVisitor::Header() const { return "digraph windep {\n"; }
+
+std::string DotTreeVisitor::Footer() const { return "}\n"; }
+
+NdjsonTreeVisitor::NdjsonTreeVisitor(std::shared_ptr<writer::Writer> writer,
+                                     bool functions)
+    : ParallelTreeVisitor(std::move(writer), 1), functions_(functions) {}
+
+void NdjsonTreeVisitor::Format(const Dependency<Image>& node, size_t height,
+                               std::string* output) const {
+  const auto& img = *node.GetContext();
+  const json img_json = {{"name", img.Name()},
+                         {"path", img.Path().u8string()},
+                         {"imports", ImportsJson(img, functions_)}};
+  *output += img_json.dump() + '\n';
+}
+
+std::string DotTreeVisitor::FormatAttributes(const Import& import) const {
+  std::string attributes;
+  // Edges which exist only due to the forwarded exports are dashed
+  if (!import.HasKind(ImportKind::kStatic) &&
+      !import.HasKind(ImportKind::kDelayed)) {
+    attributes = "style=dashed";
   }
-  if (node->GetContext()->Imports().size()) stmt.pop_back();
-  stmt += "}\n";
-  statements_ += stmt;
+  for (const auto& func : import.Functions()) {
+    if (func->IsUnresolved()) {
+      attributes += std::string(attributes.size() ? "," : "") + "color=red";
+      break;
+    }
+  }
+  return attributes;
 }
 
 std::string DotTreeVisitor::FormatId(std::shared_ptr<Context> ctx) const {
   return "\"" + ctx->String() + "\"";
 }
 
-std::string DotTreeVisitor::Dot() {
-  return "digraph windep {\n" + statements_ + "}\n";
+void CsvTreeVisitor::Format(const Dependency<Image>& node, size_t height,
+                            std::string* output) const {
+  for (auto import : node.GetContext()->Imports()) {
+    std::string missing;
+    for (const auto& func : import->Functions()) {
+      if (func->IsUnresolved()) missing += func->Name() + ';';
+    }
+    if (missing.size()) missing.pop_back();
+    *output += node.GetContext()->Name() + ',' + import->Name() + ',' +
+               missing + '\n';
+  }
 }
 
-void CsvTreeVisitor::Visit(std::shared_ptr<Dependency<Image>> node,
-                           size_t height) {
-  for (auto import : node->GetContext()->Imports()) {
-    lines_ += node->GetContext()->Name() + ',' + import->Name() + '\n';
+std::string CsvTreeVisitor::Header() const {
+  return "Source,Target,Missing\n";
+}
+
+void EdgeListTreeVisitor::Register(const Dependency<Image>& node) {
+  if (columns_ == EdgeColumns::kNames) return;
+  const auto intern = [](const std::string& name, auto* ids,
+                         std::vector<std::string>* names) {
+    if (ids->emplace(name, static_cast<uint32_t>(names->size())).second) {
+      names->push_back(name);
+    }
+  };
+  intern(node.GetContext()->Name(), &image_ids_, &images_);
+  for (const auto& import : node.GetContext()->Imports()) {
+    intern(import->Name(), &image_ids_, &images_);
+    for (const auto& func : import->Functions()) {
+      intern(func->Name(), &function_ids_, &functions_);
+    }
   }
 }
 
-std::string CsvTreeVisitor::Csv() { return "Source,Target\n" + lines_; }
+void EdgeListTreeVisitor::Format(const Dependency<Image>& node, size_t height,
+                                 std::string* output) const {
+  if (columns_ == EdgeColumns::kTables) return;
+  const auto ids = columns_ == EdgeColumns::kIds;
+  const auto& source = node.GetContext()->Name();
+  for (const auto& import : node.GetContext()->Imports()) {
+    const auto prefix =
+        ids ? std::to_string(image_ids_.find(source)->second) + ',' +
+                  std::to_string(image_ids_.find(import->Name())->second)
+            : source + ',' + import->Name();
+    for (const auto& func : import->Functions()) {
+      const auto function =
+          ids ? std::to_string(function_ids_.find(func->Name())->second)
+              : func->Name();
+      for (auto kind : {ImportKind::kStatic, ImportKind::kDelayed,
+                        ImportKind::kForwarded}) {
+        if (!func->HasKind(kind)) continue;
+        *output += prefix + ',' + function + ',' +
+                   (ids ? std::to_string(kind) : KindName(kind)) + '\n';
+      }
+    }
+  }
+}
 
-Import::Import(const std::string& name) : name_(name), alias_name_(name) {}
+std::string EdgeListTreeVisitor::Header() const {
+  return columns_ == EdgeColumns::kTables ? "Table,Id,Name\n"
+                                          : "Source,Target,Function,Kind\n";
+}
 
-Import::Import(const std::string& name, const std::string& alias)
-    : name_(name), alias_name_(alias) {}
+std::string EdgeListTreeVisitor::Footer() const {
+  if (columns_ != EdgeColumns::kTables) return "";
+  std::string tables;
+  for (size_t id = 0; id < images_.size(); ++id) {
+    tables += "image," + std::to_string(id) + ',' + images_[id] + '\n';
+  }
+  for (size_t id = 0; id < functions_.size(); ++id) {
+    tables += "function," + std::to_string(id) + ',' + functions_[id] + '\n';
+  }
+  for (auto kind :
+       {ImportKind::kStatic, ImportKind::kDelayed, ImportKind::kForwarded}) {
+    tables += "kind," + std::to_string(kind) + ',' + KindName(kind) + '\n';
+  }
+  return tables;
+}
+
+Import::Import(const std::string& name)
+    : name_(name), alias_name_(name), kinds_(ImportKind::kStatic) {}
+
+Import::Import(const std::string& name, const std::string& alias,
+               ImportKind kind)
+    : name_(name), alias_name_(alias), kinds_(kind) {}
 
 bool Import::operator<(const Import& other) const {
   return String() < other.String();
@@ -165,12 +609,14 @@ const std::string& Import::Alias() const { return alias_name_; }
 
 bool Import::IsUnresolved() const { return unresolved_; }
 
+bool Import::HasKind(ImportKind kind) const { return (kinds_ & kind) != 0; }
+
 std::string Import::String() const { return Name(); }
 
 void Import::Merge(std::shared_ptr<Context> other) {
   auto import = std::dynamic_pointer_cast<Import>(other);
-  const auto& import_functions = import->Functions();
-  functions_.insert(import_functions.begin(), import_functions.end());
+  for (const auto& func : import->Functions()) AddFunction(func);
+  kinds_ |= import->kinds_;
 }
 
 const Import::FunctionsCollection& Import::Functions() const {
@@ -178,7 +624,8 @@ const Import::FunctionsCollection& Import::Functions() const {
 }
 
 void Import::AddFunction(std::shared_ptr<Function> func) {
-  functions_.insert(func);
+  const auto [func_it, inserted] = functions_.insert(func);
+  if (!inserted) (*func_it)->Merge(func);
 }
 
 void Import::SetUnresolved(bool enable) { unresolved_ = enable; }
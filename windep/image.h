@@ -1,14 +1,20 @@
 // copyright MIT License Copyright (c) 2021, Albert Farrakhov
 
 #pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "context.h"
 #include "dependency.h"
+#include "flat_hash.h"
 #include "json/json.hpp"
 #include "traversing.h"
 #include "writer.h"
@@ -16,9 +22,23 @@
 namespace windep {
 namespace image {
 using nlohmann::json;
+// How an image refers to its import. One import may combine several kinds,
+// e.g. kernel32 both imports from and forwards exports to kernelbase.
+enum ImportKind : uint8_t { kStatic = 1, kDelayed = 2, kForwarded = 4 };
+const char* KindName(ImportKind kind);
+
 class Function : public Context {
+ protected:
+  bool unresolved_ = false;
+  // Function imported both statically and delayed has both kinds
+  uint8_t kinds_ = ImportKind::kStatic;
+
  public:
   virtual const std::string& Name() const = 0;
+  virtual bool IsUnresolved() const;
+  virtual void SetUnresolved(bool enable);
+  virtual bool HasKind(ImportKind kind) const;
+  void Merge(std::shared_ptr<Context> other) override;
 };
 
 class Import : public Context {
@@ -31,15 +51,18 @@ class Import : public Context {
   std::string alias_name_;
   FunctionsCollection functions_;
   bool unresolved_ = false;
+  uint8_t kinds_;
 
  public:
   explicit Import(const std::string& name);
-  explicit Import(const std::string& name, const std::string& alias);
+  explicit Import(const std::string& name, const std::string& alias,
+                  ImportKind kind = ImportKind::kStatic);
   bool operator<(const Import& other) const;
   bool operator==(const Import& other) const;
   virtual const std::string& Name() const;
   virtual const std::string& Alias() const;
   virtual bool IsUnresolved() const;
+  virtual bool HasKind(ImportKind kind) const;
   std::string String() const override;
   void Merge(std::shared_ptr<Context> other) override;
   virtual const FunctionsCollection& Functions() const;
@@ -63,6 +86,7 @@ class Image : public Context {
   virtual void Parse() = 0;
   virtual const std::string& Name() const;
   virtual const ImportsCollection& Imports() const;
+  virtual bool HasExport(const std::string& function) const;
   void AddImport(std::shared_ptr<Import> import);
   void ClearImports();
   const std::filesystem::path& Path() const;
@@ -72,21 +96,92 @@ class Image : public Context {
 class ImageContextFactory {
  public:
   virtual std::shared_ptr<Image> Create(const std::string& image) = 0;
+  // Images, which are going to be created soon, e.g. to read them ahead
+  virtual void Prefetch(const std::vector<std::string>& images);
+};
+
+// Keeps created images, including the failed ones, so every image is parsed
+// once per factory lifetime and can be shared by many dependency graphs.
+// Create is thread safe if the wrapped factory is.
+class CachingImageFactory : public ImageContextFactory {
+  std::shared_ptr<ImageContextFactory> image_factory_;
+  mutable std::mutex mutex_;
+  FlatHashMap<std::string, std::shared_ptr<Image>, IStringHash, IStringEq>
+      images_;
+
+ public:
+  explicit CachingImageFactory(
+      std::shared_ptr<ImageContextFactory> image_factory);
+  std::shared_ptr<Image> Create(const std::string& image) override;
+  // Created and failed images are not prefetched again
+  void Prefetch(const std::vector<std::string>& images) override;
+  size_t Size() const;
+  void Clear();
 };
 
 class ImageDependencyFactory : public DependencyFactory<Image> {
   std::string root_;
   std::shared_ptr<ImageContextFactory> image_factory_;
-  std::unordered_map<std::string, std::shared_ptr<Dependency<Image>>> visited_;
+  FlatHashMap<std::string, std::shared_ptr<Dependency<Image>>, IStringHash,
+              IStringEq>
+      visited_;
   std::shared_ptr<Dependency<Image>> CreateRecursive(
       const std::string& image,
       std::shared_ptr<Dependency<Image>> parent = nullptr);
 
  public:
+  // Marks the imported functions, which are not exported by the image
+  static void VerifyBindings(const Import& import, const Image& image);
   explicit ImageDependencyFactory(
       const std::string& root,
       std::shared_ptr<ImageContextFactory> image_factory);
   std::shared_ptr<Dependency<Image>> Create() override;
+  // Graph of another root, which shares nodes with the graphs created before
+  std::shared_ptr<Dependency<Image>> Create(const std::string& root);
+};
+
+/*
+  Builds the graph by the pipeline. Parser threads create the images and pass
+  them through the bounded queue to the linker, which is the calling thread.
+  Linker schedules the new imports for parsing, links the images to their
+  importers and visits every node as soon as it and all its imports are
+  parsed, so the streaming outputs are written while the rest of the graph is
+  discovered. Every node is visited once, in the order it gets ready, with
+  its discovery depth as the height. Image factory must be thread safe.
+*/
+class PipelineDependencyFactory : public DependencyFactory<Image> {
+  struct Parsed {
+    std::string name;
+    std::shared_ptr<Image> image;
+    std::exception_ptr error;
+  };
+
+  std::string root_;
+  std::shared_ptr<ImageContextFactory> image_factory_;
+  std::shared_ptr<TreeVisitor<Image>> visitor_;
+  size_t threads_;
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable parsed_;
+  std::condition_variable drained_;
+  // Images to parse and the parsed ones, which the linker did not take yet
+  std::deque<std::string> pending_;
+  std::deque<Parsed> done_;
+  bool stop_ = false;
+  void Parse();
+  void Schedule(const std::string& image);
+  Parsed Take();
+
+ public:
+  // Parsed images waiting for the linker, parsers stop when it is full
+  static constexpr size_t kQueueSize = 64;
+
+  // Hardware concurrency parsers if threads is 0
+  PipelineDependencyFactory(const std::string& root,
+                            std::shared_ptr<ImageContextFactory> image_factory,
+                            std::shared_ptr<TreeVisitor<Image>> visitor,
+                            size_t threads = 0);
+  std::shared_ptr<Dependency<Image>> Create() override;
 };
 
 class ImageTreeVisitor : public TreeVisitor<Image> {
@@ -95,15 +190,59 @@ class ImageTreeVisitor : public TreeVisitor<Image> {
                      size_t height) = 0;
 };
 
-class AsciiTreeVisitor : public TreeVisitor<Image> {
+/*
+  Formats the visited nodes on many threads and writes them as it goes.
+  Nodes are collected in the traversal order and formatted by batches, every
+  worker formats a contiguous part of the batch into its own chunk and the
+  chunks are written in order, so the output is identical to the serial
+  formatting and the memory use does not depend on the graph size.
+*/
+class ParallelTreeVisitor : public TreeVisitor<Image> {
   std::shared_ptr<writer::Writer> writer_;
+  std::vector<std::pair<std::shared_ptr<Dependency<Image>>, size_t>> nodes_;
+  size_t batch_size_;
+  size_t min_chunk_size_;
+  bool opened_ = false;
+  void WriteBatch();
+
+ protected:
+  // Called in the traversal order before the node is formatted, e.g. to
+  // assign ids, which are only read by Format
+  virtual void Register(const Dependency<Image>& node);
+  // Called concurrently for the different nodes, must not change the visitor
+  virtual void Format(const Dependency<Image>& node, size_t height,
+                      std::string* output) const = 0;
+  // Written before the first and after the last record
+  virtual std::string Header() const;
+  virtual std::string Footer() const;
+
+ public:
+  static constexpr size_t kBatchSize = 4096;
+  // Smaller batches are formatted by fewer workers
+  static constexpr size_t kMinChunkSize = 64;
+
+  // Batch of one node writes every node as soon as it is visited
+  explicit ParallelTreeVisitor(std::shared_ptr<writer::Writer> writer,
+                               size_t batch_size = kBatchSize,
+                               size_t min_chunk_size = kMinChunkSize);
+  void Visit(std::shared_ptr<Dependency<Image>> node, size_t height) override;
+  // Writes the rest of the records and the footer, called after the traversal
+  void Finish();
+};
+
+class AsciiTreeVisitor : public ParallelTreeVisitor {
   bool functions_ = false;
   uint8_t indent_;
 
+ protected:
+  void Format(const Dependency<Image>& node, size_t height,
+              std::string* output) const override;
+
  public:
   explicit AsciiTreeVisitor(std::shared_ptr<writer::Writer> writer,
-                            bool functions = false, uint8_t indent = 2);
-  void Visit(std::shared_ptr<Dependency<Image>> node, size_t height) override;
+                            bool functions = false, uint8_t indent = 2,
+                            size_t batch_size = kBatchSize,
+                            size_t min_chunk_size = kMinChunkSize);
 };
 
 class JsonTreeVisitor : public TreeVisitor<Image> {
@@ -116,23 +255,81 @@ class JsonTreeVisitor : public TreeVisitor<Image> {
   json& Json();
 };
 
-class DotTreeVisitor : public TreeVisitor<Image> {
-  std::string statements_;
+// One self-contained JSON line per node, written as soon as it is visited:
+// {"name": ..., "path": ..., "imports": {...}}, imports as in the json view
+class NdjsonTreeVisitor : public ParallelTreeVisitor {
+  bool functions_ = false;
+
+ protected:
+  void Format(const Dependency<Image>& node, size_t height,
+              std::string* output) const override;
+
+ public:
+  explicit NdjsonTreeVisitor(std::shared_ptr<writer::Writer> writer,
+                             bool functions = false);
+};
+
+class DotTreeVisitor : public ParallelTreeVisitor {
   uint8_t indent_;
   std::string FormatId(std::shared_ptr<Context> ctx) const;
+  std::string FormatAttributes(const Import& import) const;
+
+ protected:
+  void Format(const Dependency<Image>& node, size_t height,
+              std::string* output) const override;
+  std::string Header() const override;
+  std::string Footer() const override;
 
  public:
-  explicit DotTreeVisitor(uint8_t indent = 2) : indent_(indent) {}
-  void Visit(std::shared_ptr<Dependency<Image>> node, size_t height) override;
-  std::string Dot();
+  explicit DotTreeVisitor(std::shared_ptr<writer::Writer> writer,
+                          uint8_t indent = 2, size_t batch_size = kBatchSize,
+                          size_t min_chunk_size = kMinChunkSize)
+      : ParallelTreeVisitor(std::move(writer), batch_size, min_chunk_size),
+        indent_(indent) {}
 };
 
-class CsvTreeVisitor : public TreeVisitor<Image> {
-  std::string lines_;
+class CsvTreeVisitor : public ParallelTreeVisitor {
+ protected:
+  void Format(const Dependency<Image>& node, size_t height,
+              std::string* output) const override;
+  std::string Header() const override;
 
  public:
-  void Visit(std::shared_ptr<Dependency<Image>> node, size_t height) override;
-  std::string Csv();
+  using ParallelTreeVisitor::ParallelTreeVisitor;
+};
+
+// Rows with the names or the ids of the edge list, or the tables of the ids
+enum class EdgeColumns : uint8_t { kNames, kIds, kTables };
+
+/*
+  Long format edge list, one "source,target,function,kind" row per imported
+  function and its kind. With ids the names are replaced by the indices of
+  the image and function tables, and the kinds by their values. The tables
+  are the separate "table,id,name" output, so both outputs are plain csv.
+  Ids are assigned in the visiting order, so the tables match the rows of
+  the same traversal.
+*/
+class EdgeListTreeVisitor : public ParallelTreeVisitor {
+  EdgeColumns columns_;
+  std::vector<std::string> images_;
+  std::vector<std::string> functions_;
+  FlatHashMap<std::string, uint32_t, IStringHash, IStringEq> image_ids_;
+  FlatHashMap<std::string, uint32_t> function_ids_;
+
+ protected:
+  void Register(const Dependency<Image>& node) override;
+  void Format(const Dependency<Image>& node, size_t height,
+              std::string* output) const override;
+  std::string Header() const override;
+  std::string Footer() const override;
+
+ public:
+  explicit EdgeListTreeVisitor(std::shared_ptr<writer::Writer> writer,
+                               EdgeColumns columns = EdgeColumns::kNames,
+                               size_t batch_size = kBatchSize,
+                               size_t min_chunk_size = kMinChunkSize)
+      : ParallelTreeVisitor(std::move(writer), batch_size, min_chunk_size),
+        columns_(columns) {}
 };
 }  // namespace image
 
@@ -1,12 +1,22 @@
 // copyright MIT License Copyright (c) 2021, Albert Farrakhov
 
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "crawl.h"
 #include "cxxopts/cxxopts.hpp"
-#include "pe.h"
-#include "traversing.h"
+#include "diff.h"
+#include "exceptions.h"
+#include "flat_hash.h"
+#include "query.h"
+#include "server.h"
+#include "session.h"
+#include "utils.h"
 #include "version.h"
-#include "view.h"
 #include "writer.h"
 
 int main(int argc, char **argv) {
@@ -23,12 +33,48 @@ int main(int argc, char **argv) {
         cxxopts::value<bool>()->default_value("false"))(
         "d,delayed", "Enable delayed imports",
         cxxopts::value<bool>()->default_value("false"))(
-        "F,format", "Output format. Possible values: ascii, json, dot, csv",
-        cxxopts::value<std::string>()->default_value("ascii"))(
+        "forwarders", "Follow forwarded exports",
+        cxxopts::value<bool>()->default_value("true"))(
+        "F,format",
+        "Output format, can be repeated as format:path to write many outputs "
+        "at once. Possible values: ascii, json, ndjson, dot, csv, edges, "
+        "edges-ids, edges-names, scc, load-order, dominators",
+        cxxopts::value<std::vector<std::string>>()->default_value("ascii"))(
         "I,indent", "Output rows indent",
         cxxopts::value<uint8_t>()->default_value("2"))(
         "o,output", "File output",
         cxxopts::value<std::string>()->default_value(""))(
+        "why",
+        "Print the shortest import chains to the DLL or function, e.g. "
+        "ntdll.dll, ntdll.dll!RtlAllocateHeap or !RtlAllocateHeap",
+        cxxopts::value<std::string>()->default_value(""))(
+        "gateways",
+        "Print the DLLs which are on every import chain to the DLL",
+        cxxopts::value<std::string>()->default_value(""))(
+        "diff",
+        "Compare with the saved json output. Binary can be a json output "
+        "too. Possible formats: ascii, json, csv",
+        cxxopts::value<std::string>()->default_value(""))(
+        "crawl",
+        "Analyze every PE file in the directory tree as one graph and print "
+        "the closure sizes",
+        cxxopts::value<std::string>()->default_value(""))(
+        "include", "Crawled file name globs, e.g. *.dll",
+        cxxopts::value<std::vector<std::string>>())(
+        "exclude", "Crawled path globs relative to the directory, e.g. tests/*",
+        cxxopts::value<std::vector<std::string>>())(
+        "follow-symlinks", "Follow symlinks while crawling",
+        cxxopts::value<bool>()->default_value("false"))(
+        "dependents", "Print the crawled files which depend on the DLL",
+        cxxopts::value<std::string>()->default_value(""))(
+        "pipeline",
+        "Write csv, ndjson, dot and edges outputs while the images are "
+        "parsed, in the order they are parsed",
+        cxxopts::value<bool>()->default_value("false"))(
+        "serve", "Serve JSON line requests from stdin",
+        cxxopts::value<bool>()->default_value("false"))(
+        "listen", "Serve JSON line requests on the Unix domain socket",
+        cxxopts::value<std::string>()->default_value(""))(
         "h,help", "Print help", cxxopts::value<bool>()->default_value("false"))(
         "v,version", "Print version",
         cxxopts::value<bool>()->default_value("false"));
@@ -40,22 +86,135 @@ int main(int argc, char **argv) {
     } else if (args.count("version")) {
       std::cout << VERSION << std::endl;
       return 0;
+    } else if (args["serve"].as<bool>()) {
+      windep::server::Server().Serve(std::cin, std::cout);
+      return 0;
+    } else if (!args["listen"].as<std::string>().empty()) {
+      windep::server::Server().Listen(args["listen"].as<std::string>());
+      return 0;
     }
 
-    const auto &image = args["image"].as<std::string>();
     const auto is_delayed = args["delayed"].as<bool>();
-    const auto &format = args["format"].as<std::string>();
+    const auto forwarders = args["forwarders"].as<bool>();
+    const auto &formats = args["format"].as<std::vector<std::string>>();
     const auto functions = args["functions"].as<bool>();
     const auto indent = args["indent"].as<uint8_t>();
     const auto &output = args["output"].as<std::string>();
-    const auto pe_image_factory =
-        std::make_shared<windep::image::pe::PeImageFactory>(is_delayed);
-    windep::image::ImageDependencyFactory dep_factory{image, pe_image_factory};
-    auto root = dep_factory.Create();
-    auto view = windep::view::Factory{format}.Create(functions, indent);
+    windep::session::Options analyze_options;
+    analyze_options.delayed = is_delayed;
+    analyze_options.forwarders = forwarders;
+    const auto &why = args["why"].as<std::string>();
     auto writer =
         windep::writer::StreamFactory().Create(windep::utils::a2w(output));
-    view->Show(root, writer);
+    // "json:out.json" is written to its own file, "json" to the output
+    const auto format_writer = [&writer](const std::string &format) {
+      const auto separator = format.find(':');
+      return separator == std::string::npos
+                 ? writer
+                 : windep::writer::StreamFactory().Create(
+                       windep::utils::a2w(format.substr(separator + 1)));
+    };
+    const auto &crawl = args["crawl"].as<std::string>();
+    if (crawl.size()) {
+      windep::crawl::Options crawl_options;
+      if (args.count("include")) {
+        crawl_options.include = args["include"].as<std::vector<std::string>>();
+      }
+      if (args.count("exclude")) {
+        crawl_options.exclude = args["exclude"].as<std::vector<std::string>>();
+      }
+      if (args["follow-symlinks"].as<bool>()) {
+        crawl_options.symlinks = windep::crawl::Symlinks::kFollow;
+      }
+      std::vector<std::string> roots;
+      for (const auto &path : windep::crawl::Crawl(
+               std::filesystem::u8path(crawl), crawl_options)) {
+        roots.push_back(path.u8string());
+      }
+      if (roots.empty()) {
+        std::cerr << "[-] No PE files found in " << crawl << std::endl;
+        return 1;
+      }
+      std::vector<std::string> failed;
+      const auto index = windep::session::Session().Index(
+          roots, analyze_options, &failed);
+      windep::FlatHashSet<std::string> skipped;
+      for (const auto &root : failed) {
+        std::cerr << "[-] Cannot analyze " << root << std::endl;
+        skipped.insert(root);
+      }
+      const auto &dependents = args["dependents"].as<std::string>();
+      if (dependents.size()) {
+        for (const auto &root : index->Dependents(dependents)) {
+          writer->Write(root + '\n');
+        }
+        return 0;
+      }
+      for (const auto &root : roots) {
+        if (skipped.count(root)) continue;
+        writer->Write(root + " closure=" +
+                      std::to_string(index->ClosureSize(root)) + '\n');
+      }
+      return 0;
+    }
+    const auto &image = args["image"].as<std::string>();
+    if (why.size()) {
+      const auto target = windep::query::Target::Parse(why);
+      const auto chains =
+          windep::session::Session().Why(image, target, analyze_options);
+      if (chains.empty()) {
+        std::cerr << "[-] " << target.String() << " is not imported by "
+                  << image << std::endl;
+        return 1;
+      }
+      for (const auto &chain : chains) {
+        writer->Write(windep::query::Format(chain, target) + '\n');
+      }
+      return 0;
+    }
+    const auto &diff = args["diff"].as<std::string>();
+    if (diff.size()) {
+      windep::diff::Differ differ;
+      const auto before = differ.Load(diff);
+      const auto after =
+          std::filesystem::u8path(image).extension() == ".json"
+              ? differ.Load(image)
+              : differ.Load(windep::session::Session()
+                                .Analyze(image, analyze_options)
+                                ->Root());
+      const auto changes = differ.Compare(before, after);
+      for (const auto &format : formats) {
+        windep::diff::Show(changes, format.substr(0, format.find(':')), indent,
+                           format_writer(format));
+      }
+      return 0;
+    }
+    const auto &gateways = args["gateways"].as<std::string>();
+    if (gateways.size()) {
+      const auto graph =
+          windep::session::Session().Analyze(image, analyze_options);
+      for (const auto &gateway : graph->Gateways(gateways)) {
+        writer->Write(gateway + '\n');
+      }
+      return 0;
+    }
+    std::vector<std::pair<windep::session::RenderOptions,
+                          std::shared_ptr<windep::writer::Writer>>>
+        outputs;
+    for (const auto &format : formats) {
+      windep::session::RenderOptions render_options;
+      render_options.format = format.substr(0, format.find(':'));
+      render_options.functions = functions;
+      render_options.indent = indent;
+      outputs.emplace_back(render_options, format_writer(format));
+    }
+    if (args["pipeline"].as<bool>()) {
+      windep::session::Session().Stream(image, analyze_options, outputs);
+    } else {
+      windep::session::Session()
+          .Analyze(image, analyze_options)
+          ->Render(outputs);
+    }
   } catch (const std::exception &e) {
     std::cerr << "[-] " << e.what() << std::endl;
     return 1;
@@ -1,6 +1,12 @@
 // copyright MIT License Copyright (c) 2021, Albert Farrakhov
 #include "pe.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <mutex>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -31,33 +37,364 @@ API_SET_NAMESPACE_ARRAY* GetApiSetHeader() {
 #endif
 }
 
-void PeImage::Parse() {
-  LoadedImage loaded_image{name_};
-  path_ = std::move(loaded_image.Path());
-  auto imports = ParseImports(loaded_image);
-  if (delayed_) {
-    auto delayed_imports = ParseDelayedImports(loaded_image);
-    imports.insert(delayed_imports.begin(), delayed_imports.end());
+// Strips '-l<major>-<minor>-<patch>' suffix of the ApiSet name
+template <typename Char>
+std::basic_string_view<Char> StripApiSetVersion(
+    std::basic_string_view<Char> name) {
+  auto end = name.size();
+  for (int group = 0; group < 3; ++group) {
+    auto start = end;
+    while (start && name[start - 1] >= '0' && name[start - 1] <= '9') start--;
+    if (start == end || start < 2) return name;
+    end = start - 1;
+    if (group < 2 && name[end] != '-') return name;
+    if (group == 2) {
+      if (name[end] != 'l' || name[end - 1] != '-') return name;
+      end--;
+    }
+  }
+  return end ? name.substr(0, end) : name;
+}
+
+// Walks the import name table. Ordinal-only thunks are resolved to names
+// through the export table of the imported DLL, or shown as '#ordinal'.
+template <typename T, typename F>
+void AddImportFunctions(const LoadedImage& img, T thunk, const F ordinal_flag,
+                        std::shared_ptr<PeImport> import, ImportKind kind) {
+  if (!thunk) return;
+  std::shared_ptr<const PeExports> exports;
+  bool exports_queried = false;
+  for (; thunk->u1.AddressOfData; thunk++) {
+    if (thunk->u1.Ordinal & ordinal_flag) {
+      if (!exports_queried) {
+        exports = PeMeta::Instance().Exports(import->Name());
+        exports_queried = true;
+      }
+      const auto ordinal = static_cast<WORD>(thunk->u1.Ordinal & 0xffff);
+      const auto name = exports ? exports->Name(ordinal) : nullptr;
+      import->AddFunction(std::make_shared<PeFunction>(
+          name ? *name : "#" + std::to_string(ordinal), import, kind));
+    } else {
+      auto func_meta =
+          img.Read<PIMAGE_IMPORT_BY_NAME>(thunk->u1.AddressOfData);
+      if (func_meta) {
+        import->AddFunction(
+            std::make_shared<PeFunction>(func_meta->Name, import, kind));
+      }
+    }
+  }
+}
+
+PeLoad Load(const std::string& image, bool fingerprint) {
+  PeLoad load;
+  try {
+    load.image = std::make_unique<LoadedImage>(image);
+    if (fingerprint) load.fingerprint = load.image->Fingerprint();
+  } catch (...) {
+    load.error = std::current_exception();
+  }
+  return load;
+}
+
+PeLoader::PeLoader(bool fingerprints, size_t threads)
+    : fingerprints_(fingerprints), threads_(threads) {}
+
+PeLoader::~PeLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  queued_.notify_all();
+  for (auto& worker : workers_) worker.join();
+}
+
+void PeLoader::Prefetch(const std::vector<std::string>& images) {
+  if (!threads_) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Depth first traversal creates the first import next, so it goes last
+    for (auto image_it = images.rbegin(); image_it != images.rend();
+         ++image_it) {
+      if (slots_.count(*image_it)) continue;
+      slots_[*image_it];
+      queue_.push_back(*image_it);
+    }
+    // Workers are started by the first prefetch, the most factories have
+    // nothing to read ahead
+    while (queue_.size() && workers_.size() < threads_) {
+      workers_.emplace_back(&PeLoader::Work, this);
+    }
   }
+  queued_.notify_all();
+}
+
+void PeLoader::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_.wait(lock, [this] { return stop_ || queue_.size(); });
+    if (stop_) return;
+    const auto image = std::move(queue_.back());
+    queue_.pop_back();
+    // Image may be already taken or queued twice
+    auto slot_it = slots_.find(image);
+    if (slot_it == slots_.end() || slot_it->second.state != State::kQueued) {
+      continue;
+    }
+    slot_it->second.state = State::kLoading;
+    lock.unlock();
+    auto load = Load(image, fingerprints_);
+    lock.lock();
+    auto& slot = slots_[image];
+    slot.load = std::move(load);
+    slot.state = State::kLoaded;
+    loaded_.notify_all();
+  }
+}
+
+PeLoad PeLoader::Take(const std::string& image) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto slot_it = slots_.find(image);
+  if (slot_it == slots_.end() || slot_it->second.state == State::kQueued) {
+    slots_.erase(image);
+    lock.unlock();
+    return Load(image, fingerprints_);
+  }
+  loaded_.wait(lock, [this, &image] {
+    return slots_.find(image)->second.state == State::kLoaded;
+  });
+  auto load = std::move(slots_.find(image)->second.load);
+  slots_.erase(image);
+  return load;
+}
+
+void PeImage::Parse() { Parse(nullptr); }
+
+void PeImage::Parse(PeContents* contents, PeLoader* loader) {
+  auto load = loader ? loader->Take(name_) : Load(name_, contents != nullptr);
+  if (load.error) std::rethrow_exception(load.error);
+  const auto& loaded_image = *load.image;
+  path_ = std::move(loaded_image.Path());
+  bytes_read_ = loaded_image.BytesRead();
+  exports_ = PeMeta::Instance().Exports(name_, loaded_image);
   ClearImports();
-  for (auto import : imports) {
+  const auto fingerprint = contents ? load.fingerprint : 0;
+  if (fingerprint && contents->Find(fingerprint, &imports_)) return;
+  for (auto import : ParseImports(loaded_image)) {
     AddImport(import);
   }
+  if (delayed_) {
+    for (auto import : ParseDelayedImports(loaded_image)) {
+      AddImport(import);
+    }
+  }
+  if (forwarders_) {
+    for (auto import : ParseForwarders(loaded_image)) {
+      AddImport(import);
+    }
+  }
+  if (fingerprint) contents->Add(fingerprint, imports_);
+}
+
+bool PeContents::Find(uint64_t fingerprint,
+                      Image::ImportsCollection* imports) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto content_it = imports_.find(fingerprint);
+  if (content_it == imports_.end()) return false;
+  *imports = content_it->second;
+  return true;
+}
+
+void PeContents::Add(uint64_t fingerprint,
+                     const Image::ImportsCollection& imports) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  imports_.emplace(fingerprint, imports);
+}
+
+std::wstring ModuleFileName(HMODULE module) {
+  std::vector<wchar_t> path(MAX_PATH, L'\0');
+  DWORD result = 0;
+  // Truncated path fills the whole buffer
+  while ((result = ::GetModuleFileNameW(module, path.data(),
+                                        static_cast<DWORD>(path.size()))) ==
+         path.size()) {
+    path.resize(path.size() * 2);
+  }
+  return std::wstring(path.data(), result);
+}
+
+// Path of the image mapped by the loader. Module mapped as the resource has
+// no file name where the loader doesn't track it, then the image is loaded
+// without running its code as the loader would do it.
+std::wstring LoaderImage(const std::wstring& name) {
+  std::wstring path;
+  for (const DWORD flags :
+       {LOAD_LIBRARY_AS_IMAGE_RESOURCE, DONT_RESOLVE_DLL_REFERENCES}) {
+    const auto module = ::LoadLibraryExW(name.c_str(), nullptr, flags);
+    if (!module) return {};
+    path = ModuleFileName(module);
+    ::FreeLibrary(module);
+    if (path.size()) break;
+  }
+  return path;
+}
+
+// String of the API which returns the required buffer size, null
+// terminator included, when the buffer is too small
+template <typename Query>
+std::wstring QueryString(Query query) {
+  std::vector<wchar_t> buffer(MAX_PATH, L'\0');
+  auto result = query(buffer.data(), static_cast<DWORD>(buffer.size()));
+  if (result > buffer.size()) {
+    buffer.resize(static_cast<size_t>(result));
+    result = query(buffer.data(), static_cast<DWORD>(buffer.size()));
+  }
+  return result && result < buffer.size()
+             ? std::wstring(buffer.data(), result)
+             : std::wstring();
+}
+
+// Directories of the loader's safe search order: the application, system
+// and Windows directories, then the current directory and PATH
+std::wstring SafeSearchPath() {
+  std::wstring search_path;
+  const auto append = [&search_path](const std::wstring& directory) {
+    if (directory.empty()) return;
+    if (search_path.size()) search_path += L';';
+    search_path += directory;
+  };
+  const auto application = ModuleFileName(nullptr);
+  append(application.substr(0, application.find_last_of(L'\\')));
+  append(QueryString([](wchar_t* buffer, DWORD size) {
+    return ::GetSystemDirectoryW(buffer, size);
+  }));
+  append(QueryString([](wchar_t* buffer, DWORD size) {
+    return ::GetWindowsDirectoryW(buffer, size);
+  }));
+  append(QueryString([](wchar_t* buffer, DWORD size) {
+    return ::GetCurrentDirectoryW(size, buffer);
+  }));
+  append(QueryString([](wchar_t* buffer, DWORD size) {
+    return ::GetEnvironmentVariableW(L"PATH", buffer, size);
+  }));
+  return search_path;
 }
 
-LoadedImage::LoadedImage(const std::string& name) : name_(name) {
-  image_handle_ =
-      ::LoadLibraryExA(name.c_str(), nullptr, DONT_RESOLVE_DLL_REFERENCES);
-  if (!image_handle_) {
+/*
+  Full path of the image as the loader resolves it. Search path is given
+  explicitly in the safe order, where the current directory goes after the
+  system ones as for the loader, so the search mode of the host process is
+  left as is. Modules already loaded by the process, side-by-side
+  assemblies and the images missing from the search path are resolved by
+  the loader itself, its search is slower than SearchPathW.
+*/
+std::wstring SearchImage(const std::string& name) {
+  const auto wide_name = utils::a2w(name);
+  HMODULE module = nullptr;
+  if (::GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                           wide_name.c_str(), &module)) {
+    return ModuleFileName(module);
+  }
+  ACTCTX_SECTION_KEYED_DATA redirection{};
+  redirection.cbSize = sizeof(redirection);
+  std::wstring path;
+  if (::FindActCtxSectionStringW(0, nullptr,
+                                 ACTIVATION_CONTEXT_SECTION_DLL_REDIRECTION,
+                                 wide_name.c_str(), &redirection)) {
+    path = LoaderImage(wide_name);
+  } else {
+    const auto search_path = SafeSearchPath();
+    std::vector<wchar_t> buffer(MAX_PATH, L'\0');
+    auto result =
+        ::SearchPathW(search_path.c_str(), wide_name.c_str(), nullptr,
+                      static_cast<DWORD>(buffer.size()), buffer.data(),
+                      nullptr);
+    if (result > buffer.size()) {
+      buffer.resize(static_cast<size_t>(result));
+      result = ::SearchPathW(search_path.c_str(), wide_name.c_str(),
+                             nullptr, static_cast<DWORD>(buffer.size()),
+                             buffer.data(), nullptr);
+    }
+    path = result && result <= buffer.size()
+               ? std::wstring(buffer.data(), result)
+               : LoaderImage(wide_name);
+  }
+  if (path.empty()) {
     throw exc::NotFound("Cannot open '" + name + "' image");
   }
-  image_view_ =
-      reinterpret_cast<LPVOID>(reinterpret_cast<uintptr_t>(image_handle_) &
-                               (static_cast<uintptr_t>(-1) << 1));
-  dos_header_ = static_cast<PIMAGE_DOS_HEADER>(image_view_);
-  if (dos_header_->e_magic != IMAGE_DOS_SIGNATURE) {
-    throw exc::Validation("Image '" + name + "' is not executable");
+  return path;
+}
+
+LoadedImage::LoadedImage(const std::string& name)
+    : name_(name), path_(SearchImage(name)) {
+  file_ = ::CreateFileW(path_.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                        OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    throw exc::NotFound("Cannot open '" + name + "' image");
+  }
+  // Destructor is not called if the constructor throws
+  try {
+    ReadHeaders();
+    Prefetch();
+  } catch (...) {
+    Release();
+    throw;
+  }
+}
+
+DWORD LoadedImage::ReadAt(ULONGLONG offset, DWORD size, LPVOID buffer) {
+  OVERLAPPED overlapped{};
+  overlapped.Offset = static_cast<DWORD>(offset);
+  overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+  DWORD read = 0;
+  if (!::ReadFile(file_, buffer, size, &read, &overlapped) &&
+      ::GetLastError() != ERROR_HANDLE_EOF) {
+    throw exc::WinException("Failed to read '" + name_ + "' image");
+  }
+  bytes_read_ += read;
+  ++reads_;
+  return read;
+}
+
+void LoadedImage::ReadHeaders() {
+  LARGE_INTEGER file_size{};
+  if (!::GetFileSizeEx(file_, &file_size)) {
+    throw exc::WinException("Failed to read '" + name_ + "' image");
+  }
+  file_size_ = static_cast<ULONGLONG>(file_size.QuadPart);
+  // DOS, NT and section headers fit the first page of most images
+  std::vector<BYTE> headers(kPageSize, 0);
+  const auto read = ReadAt(0, kPageSize, headers.data());
+  const auto dos_header = reinterpret_cast<PIMAGE_DOS_HEADER>(headers.data());
+  if (read < sizeof(IMAGE_DOS_HEADER) ||
+      dos_header->e_magic != IMAGE_DOS_SIGNATURE ||
+      dos_header->e_lfanew < 0 ||
+      static_cast<DWORD>(dos_header->e_lfanew) + sizeof(IMAGE_NT_HEADERS64) >
+          read) {
+    throw exc::Validation("Image '" + name_ + "' is not executable");
+  }
+  const auto nt_headers = reinterpret_cast<PIMAGE_NT_HEADERS32>(
+      headers.data() + dos_header->e_lfanew);
+  if (nt_headers->Signature != IMAGE_NT_SIGNATURE) {
+    throw exc::Validation("Image '" + name_ + "' is not executable");
   }
+  // SizeOfImage and SizeOfHeaders have the same offsets in both headers
+  image_size_ = nt_headers->OptionalHeader.SizeOfImage;
+  const auto headers_size = std::min(
+      nt_headers->OptionalHeader.SizeOfHeaders, image_size_);
+  if (static_cast<DWORD>(dos_header->e_lfanew) +
+          sizeof(IMAGE_NT_HEADERS64) >
+      image_size_) {
+    throw exc::Validation("Image '" + name_ + "' is not executable");
+  }
+  image_view_ = ::VirtualAlloc(nullptr, image_size_, MEM_COMMIT | MEM_RESERVE,
+                               PAGE_READWRITE);
+  if (!image_view_) {
+    throw exc::WinException("Failed to allocate '" + name_ + "' image");
+  }
+  pages_.resize((image_size_ + kPageSize - 1) / kPageSize);
+  const auto copied = std::min(read, headers_size);
+  std::copy_n(headers.begin(), copied, static_cast<PBYTE>(image_view_));
+  dos_header_ = static_cast<PIMAGE_DOS_HEADER>(image_view_);
   nt_headers_.x32 = reinterpret_cast<PIMAGE_NT_HEADERS32>(
       static_cast<PBYTE>(image_view_) + dos_header_->e_lfanew);
   if (IsPe64()) {
@@ -65,6 +402,241 @@ LoadedImage::LoadedImage(const std::string& name) : name_(name) {
         static_cast<PBYTE>(image_view_) + dos_header_->e_lfanew);
   }
   section_headers_ = IMAGE_FIRST_SECTION(nt_headers_.x32);
+  // Section table of the images with many sections may cross the first page
+  const auto sections_end =
+      static_cast<ULONGLONG>(dos_header_->e_lfanew) +
+      (reinterpret_cast<PBYTE>(section_headers_) -
+       reinterpret_cast<PBYTE>(nt_headers_.x32)) +
+      static_cast<ULONGLONG>(FileHeader()->NumberOfSections) *
+          sizeof(IMAGE_SECTION_HEADER);
+  if (sections_end > headers_size) {
+    throw exc::Validation("Image '" + name_ + "' is not executable");
+  }
+  if (headers_size > copied) {
+    ReadAt(copied, headers_size - copied,
+           static_cast<PBYTE>(image_view_) + copied);
+  }
+  // Sections of the low alignment images may share the last headers page
+  const auto headers_end = static_cast<DWORD>(std::min<ULONGLONG>(
+      (static_cast<ULONGLONG>(headers_size) + kPageSize - 1) / kPageSize *
+          kPageSize,
+      image_size_));
+  ReadRange(headers_size, headers_end);
+  for (DWORD page = 0; page * kPageSize < headers_end; ++page) {
+    pages_[page] = true;
+  }
+}
+
+void LoadedImage::ReadRange(DWORD begin, DWORD end) {
+  const auto headers_size =
+      std::min(nt_headers_.x32->OptionalHeader.SizeOfHeaders, image_size_);
+  const auto sections = section_headers_;
+  const auto sections_end = sections + FileHeader()->NumberOfSections;
+  while (begin < end) {
+    // Headers are mapped at the same offsets as in the file
+    DWORD start = 0;
+    DWORD limit = headers_size;
+    DWORD raw_offset = 0;
+    DWORD raw_size = headers_size;
+    if (begin >= headers_size) {
+      auto section = std::find_if(sections, sections_end, [begin](auto& s) {
+        return begin >= s.VirtualAddress &&
+               begin - s.VirtualAddress <
+                   std::max(s.Misc.VirtualSize, s.SizeOfRawData);
+      });
+      if (section == sections_end) {
+        // Padding between the sections is zeroed, skip to the next section
+        DWORD next = end;
+        for (auto s = sections; s != sections_end; ++s) {
+          if (s->VirtualAddress > begin) {
+            next = std::min(next, s->VirtualAddress);
+          }
+        }
+        begin = next;
+        continue;
+      }
+      start = section->VirtualAddress;
+      limit = start + std::max(section->Misc.VirtualSize,
+                               section->SizeOfRawData);
+      raw_offset = section->PointerToRawData;
+      raw_size = section->SizeOfRawData;
+    }
+    const auto chunk_end = std::min(end, limit);
+    // Virtual size beyond the raw data is zeroed as by the loader
+    const auto offset = begin - start;
+    if (offset < raw_size) {
+      ReadAt(static_cast<ULONGLONG>(raw_offset) + offset,
+             std::min(chunk_end - begin, raw_size - offset),
+             static_cast<PBYTE>(image_view_) + begin);
+    }
+    begin = chunk_end;
+  }
+}
+
+bool LoadedImage::Loaded(DWORD rva, DWORD size) const {
+  if (static_cast<ULONGLONG>(rva) + size > image_size_) return false;
+  return !size ||
+         (pages_[rva / kPageSize] && pages_[(rva + size - 1) / kPageSize]);
+}
+
+void LoadedImage::Fetch(const std::vector<std::pair<DWORD, DWORD>>& ranges) {
+  std::vector<DWORD> pages;
+  for (const auto& [rva, size] : ranges) {
+    if (!size || rva >= image_size_) continue;
+    const auto last = static_cast<DWORD>(
+        (std::min<ULONGLONG>(static_cast<ULONGLONG>(rva) + size, image_size_) -
+         1) /
+        kPageSize);
+    for (auto page = rva / kPageSize; page <= last; ++page) {
+      if (!pages_[page]) pages.push_back(page);
+    }
+  }
+  std::sort(pages.begin(), pages.end());
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+  // Close pages are read by one read, ReadRange splits it by the sections
+  for (size_t i = 0; i < pages.size();) {
+    const auto first = pages[i];
+    auto last = first;
+    for (++i; i < pages.size() && pages[i] - last <= kMaxGap + 1; ++i) {
+      last = pages[i];
+    }
+    const auto end =
+        std::min<ULONGLONG>((static_cast<ULONGLONG>(last) + 1) * kPageSize,
+                            image_size_);
+    ReadRange(first * kPageSize, static_cast<DWORD>(end));
+    for (auto page = first; page <= last; ++page) pages_[page] = true;
+  }
+}
+
+void LoadedImage::FetchTerminated(
+    std::vector<std::pair<DWORD, DWORD>> arrays) {
+  while (arrays.size()) {
+    // First unread element of every unterminated array
+    std::vector<std::pair<DWORD, DWORD>> missing;
+    std::vector<std::pair<DWORD, DWORD>> pending;
+    for (const auto& [rva, element] : arrays) {
+      for (auto at = static_cast<ULONGLONG>(rva); at + element <= image_size_;
+           at += element) {
+        const auto offset = static_cast<DWORD>(at);
+        if (!Loaded(offset, element)) {
+          missing.emplace_back(offset, element);
+          pending.emplace_back(offset, element);
+          break;
+        }
+        const auto bytes = Read<PBYTE>(offset);
+        if (std::all_of(bytes, bytes + element, [](BYTE b) { return !b; })) {
+          break;
+        }
+      }
+    }
+    Fetch(missing);
+    arrays = std::move(pending);
+  }
+}
+
+void LoadedImage::Prefetch() {
+  const auto directories = DataDirectory();
+  const auto& imports = directories[IMAGE_DIRECTORY_ENTRY_IMPORT];
+  const auto& delayed = directories[IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT];
+  const auto& exports = directories[IMAGE_DIRECTORY_ENTRY_EXPORT];
+  // Descriptors are terminated by the zeroed one, which Size may not include
+  std::vector<std::pair<DWORD, DWORD>> arrays;
+  if (imports.Size) {
+    arrays.emplace_back(imports.VirtualAddress,
+                        sizeof(IMAGE_IMPORT_DESCRIPTOR));
+  }
+  if (delayed.Size) {
+    arrays.emplace_back(delayed.VirtualAddress,
+                        sizeof(IMAGE_DELAYLOAD_DESCRIPTOR));
+  }
+  Fetch({{imports.VirtualAddress, imports.Size},
+         {delayed.VirtualAddress, delayed.Size},
+         {exports.VirtualAddress, exports.Size}});
+  FetchTerminated(std::move(arrays));
+
+  // Names of the imported DLLs, name tables and the export tables
+  const DWORD thunk_size = IsPe64() ? sizeof(ULONGLONG) : sizeof(DWORD);
+  std::vector<DWORD> thunks;
+  arrays.clear();
+  for (auto rva = imports.VirtualAddress;
+       imports.Size && Loaded(rva, sizeof(IMAGE_IMPORT_DESCRIPTOR));
+       rva += sizeof(IMAGE_IMPORT_DESCRIPTOR)) {
+    const auto descr = Read<PIMAGE_IMPORT_DESCRIPTOR>(rva);
+    if (!descr->OriginalFirstThunk || descr->OriginalFirstThunk & 1) break;
+    arrays.emplace_back(descr->Name, 1);
+    arrays.emplace_back(descr->OriginalFirstThunk, thunk_size);
+    thunks.push_back(descr->OriginalFirstThunk);
+  }
+  for (auto rva = delayed.VirtualAddress;
+       delayed.Size && Loaded(rva, sizeof(IMAGE_DELAYLOAD_DESCRIPTOR));
+       rva += sizeof(IMAGE_DELAYLOAD_DESCRIPTOR)) {
+    const auto descr = Read<PIMAGE_DELAYLOAD_DESCRIPTOR>(rva);
+    if (!descr->DllNameRVA) break;
+    arrays.emplace_back(descr->DllNameRVA, 1);
+    if (descr->ImportNameTableRVA) {
+      arrays.emplace_back(descr->ImportNameTableRVA, thunk_size);
+      thunks.push_back(descr->ImportNameTableRVA);
+    }
+  }
+  PIMAGE_EXPORT_DIRECTORY export_directory = nullptr;
+  if (exports.Size && Loaded(exports.VirtualAddress,
+                             sizeof(IMAGE_EXPORT_DIRECTORY))) {
+    export_directory = Read<PIMAGE_EXPORT_DIRECTORY>(exports.VirtualAddress);
+    const auto names = export_directory->NumberOfNames;
+    Fetch({{export_directory->AddressOfNames,
+            static_cast<DWORD>(names * sizeof(DWORD))},
+           {export_directory->AddressOfNameOrdinals,
+            static_cast<DWORD>(names * sizeof(WORD))},
+           {export_directory->AddressOfFunctions,
+            static_cast<DWORD>(export_directory->NumberOfFunctions *
+                               sizeof(DWORD))}});
+  }
+  FetchTerminated(std::move(arrays));
+
+  // Hint/name entries of the imported functions and the exported names
+  const auto ordinal_flag =
+      IsPe64() ? IMAGE_ORDINAL_FLAG64 : IMAGE_ORDINAL_FLAG32;
+  arrays.clear();
+  for (const auto thunk : thunks) {
+    for (auto rva = thunk; Loaded(rva, thunk_size); rva += thunk_size) {
+      ULONGLONG data = 0;
+      std::copy_n(Read<PBYTE>(rva), thunk_size, reinterpret_cast<PBYTE>(&data));
+      if (!data) break;
+      if (data & ordinal_flag) continue;
+      arrays.emplace_back(
+          static_cast<DWORD>(data + offsetof(IMAGE_IMPORT_BY_NAME, Name)), 1);
+    }
+  }
+  if (export_directory &&
+      Loaded(export_directory->AddressOfNames,
+             export_directory->NumberOfNames * sizeof(DWORD))) {
+    const auto names = Read<PDWORD>(export_directory->AddressOfNames);
+    for (DWORD i = 0; i < export_directory->NumberOfNames; ++i) {
+      arrays.emplace_back(names[i], 1);
+    }
+  }
+  FetchTerminated(std::move(arrays));
+}
+
+uint64_t LoadedImage::Fingerprint() const {
+  // Unread pages are zeroed, so the same read pages make the same view
+  auto fingerprint = file_size_ * 0x9e3779b97f4a7c15ull;
+  for (size_t page = 0; page < pages_.size();) {
+    if (!pages_[page]) {
+      ++page;
+      continue;
+    }
+    auto last = page;
+    while (last < pages_.size() && pages_[last]) ++last;
+    const auto begin = page * kPageSize;
+    const auto end = std::min<size_t>(last * kPageSize, image_size_);
+    fingerprint = (fingerprint ^ (static_cast<uint64_t>(page) << 32) ^
+                   utils::hash(std::string_view(Read<const char*>(begin),
+                                                end - begin))) *
+                  0x100000001b3ull;
+    page = last;
+  }
+  return fingerprint ? fingerprint : 1;
 }
 
 Image::ImportsCollection PeImage::ParseImports(const LoadedImage& img) const {
@@ -77,30 +649,14 @@ Image::ImportsCollection PeImage::ParseImports(const LoadedImage& img) const {
       if (virtual_name) {
         auto logic_name = PeMeta::Instance().VirtualToLogic(virtual_name);
         auto import = std::make_shared<PeImport>(logic_name, virtual_name);
-        const auto find_import_funcs =
-            [&import, &img, this](auto thunk, const auto ordinal_flag) {
-              if (thunk) {
-                while (thunk->u1.AddressOfData) {
-                  if (!(thunk->u1.Ordinal & ordinal_flag)) {
-                    auto func_meta = img.Read<PIMAGE_IMPORT_BY_NAME>(
-                        thunk->u1.AddressOfData);
-                    if (func_meta) {
-                      import->AddFunction(std::make_shared<PeFunction>(
-                          func_meta->Name, import));
-                    }
-                  }
-                  thunk++;
-                }
-              }
-            };
         if (img.IsPe64()) {
-          find_import_funcs(
-              img.Read<PIMAGE_THUNK_DATA64>(descr->OriginalFirstThunk),
-              IMAGE_ORDINAL_FLAG64);
+          AddImportFunctions(
+              img, img.Read<PIMAGE_THUNK_DATA64>(descr->OriginalFirstThunk),
+              IMAGE_ORDINAL_FLAG64, import, ImportKind::kStatic);
         } else {
-          find_import_funcs(
-              img.Read<PIMAGE_THUNK_DATA32>(descr->OriginalFirstThunk),
-              IMAGE_ORDINAL_FLAG32);
+          AddImportFunctions(
+              img, img.Read<PIMAGE_THUNK_DATA32>(descr->OriginalFirstThunk),
+              IMAGE_ORDINAL_FLAG32, import, ImportKind::kStatic);
         }
         imports.insert(import);
       }
@@ -120,31 +676,16 @@ Image::ImportsCollection PeImage::ParseDelayedImports(
       auto virtual_name = img.Read<PCSTR>(descr->DllNameRVA);
       if (virtual_name) {
         auto logic_name = PeMeta::Instance().VirtualToLogic(virtual_name);
-        auto import = std::make_shared<PeImport>(logic_name, virtual_name);
-        const auto find_import_funcs =
-            [&import, &img, this](auto thunk, const auto ordinal_flag) {
-              if (thunk) {
-                while (thunk->u1.AddressOfData) {
-                  if (!(thunk->u1.Ordinal & ordinal_flag)) {
-                    auto func_meta = img.Read<PIMAGE_IMPORT_BY_NAME>(
-                        thunk->u1.AddressOfData);
-                    if (func_meta) {
-                      import->AddFunction(std::make_shared<PeFunction>(
-                          func_meta->Name, import));
-                    }
-                  }
-                  thunk++;
-                }
-              }
-            };
+        auto import = std::make_shared<PeImport>(logic_name, virtual_name,
+                                                 ImportKind::kDelayed);
         if (img.IsPe64()) {
-          find_import_funcs(
-              img.Read<PIMAGE_THUNK_DATA64>(descr->ImportNameTableRVA),
-              IMAGE_ORDINAL_FLAG64);
+          AddImportFunctions(
+              img, img.Read<PIMAGE_THUNK_DATA64>(descr->ImportNameTableRVA),
+              IMAGE_ORDINAL_FLAG64, import, ImportKind::kDelayed);
         } else {
-          find_import_funcs(
-              img.Read<PIMAGE_THUNK_DATA32>(descr->ImportNameTableRVA),
-              IMAGE_ORDINAL_FLAG32);
+          AddImportFunctions(
+              img, img.Read<PIMAGE_THUNK_DATA32>(descr->ImportNameTableRVA),
+              IMAGE_ORDINAL_FLAG32, import, ImportKind::kDelayed);
         }
         imports.insert(import);
       }
@@ -154,8 +695,33 @@ Image::ImportsCollection PeImage::ParseDelayedImports(
   return imports;
 }
 
-PeImage::PeImage(const std::string& name, bool delayed)
-    : Image(utils::lower(name)), delayed_(delayed) {}
+Image::ImportsCollection PeImage::ParseForwarders(
+    const LoadedImage& img) const {
+  Image::ImportsCollection imports;
+  FlatHashMap<std::string, std::shared_ptr<PeImport>> forwarded;
+  for (const auto& forwarder : exports_->Forwarders()) {
+    auto& import = forwarded[forwarder.dll];
+    if (!import) {
+      import = std::make_shared<PeImport>(forwarder.dll, forwarder.alias,
+                                          ImportKind::kForwarded);
+      imports.insert(import);
+    }
+    import->AddFunction(std::make_shared<PeFunction>(
+        forwarder.function, import, ImportKind::kForwarded));
+  }
+  return imports;
+}
+
+PeImage::PeImage(const std::string& name, bool delayed, bool forwarders)
+    : Image(name), delayed_(delayed), forwarders_(forwarders) {
+  utils::lower_inplace(&name_);
+}
+
+bool PeImage::HasExport(const std::string& function) const {
+  return !exports_ || exports_->Has(function);
+}
+
+size_t PeImage::BytesRead() const { return bytes_read_; }
 
 const PIMAGE_FILE_HEADER LoadedImage::FileHeader() const {
   return &nt_headers_.x32->FileHeader;
@@ -166,35 +732,98 @@ const PIMAGE_DATA_DIRECTORY LoadedImage::DataDirectory() const {
   return nt_headers_.x32->OptionalHeader.DataDirectory;
 }
 
-std::wstring LoadedImage::Path() const {
-  std::vector<wchar_t> path(MAX_PATH, L'\0');
-  auto result = ::GetModuleFileNameW(image_handle_, path.data(),
-                                     static_cast<DWORD>(path.size()));
-  if (result > path.size()) {
-    path.resize(static_cast<size_t>(result));
-    result = ::GetModuleFileNameW(image_handle_, path.data(),
-                                  static_cast<DWORD>(path.size()));
+std::wstring LoadedImage::Path() const { return path_; }
+
+size_t LoadedImage::BytesRead() const { return bytes_read_; }
+
+size_t LoadedImage::Reads() const { return reads_; }
+
+void LoadedImage::Release() {
+  if (image_view_) {
+    ::VirtualFree(image_view_, 0, MEM_RELEASE);
+    image_view_ = nullptr;
   }
-  if (!result) {
-    throw exc::NotFound("Failed to get module path: " + name_);
+  if (file_ != INVALID_HANDLE_VALUE) {
+    ::CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
   }
-  return std::wstring(path.data());
 }
 
-LoadedImage::~LoadedImage() {
-  if (image_handle_) {
-    ::FreeLibrary(image_handle_);
-    image_handle_ = nullptr;
-  }
-}
+LoadedImage::~LoadedImage() { Release(); }
 
 const bool LoadedImage::IsPe64() const {
   return nt_headers_.x32->FileHeader.Machine == IMAGE_FILE_MACHINE_AMD64;
 }
 
+PeExports::PeExports(const LoadedImage& img) {
+  auto section = img.DataDirectory()[IMAGE_DIRECTORY_ENTRY_EXPORT];
+  if (!section.Size) return;
+  auto descr = img.Read<PIMAGE_EXPORT_DIRECTORY>(section.VirtualAddress);
+  ordinal_base_ = descr->Base;
+  ordinal_names_.resize(descr->NumberOfFunctions);
+  ordinals_.resize(descr->NumberOfFunctions);
+  auto names = img.Read<PDWORD>(descr->AddressOfNames);
+  auto name_ordinals = img.Read<PWORD>(descr->AddressOfNameOrdinals);
+  for (DWORD i = 0; i < descr->NumberOfNames; ++i) {
+    const auto index = name_ordinals[i];
+    if (index < ordinal_names_.size()) {
+      ordinal_names_[index] = img.Read<PCSTR>(names[i]);
+    }
+  }
+  // Function RVA pointing inside the export directory is a forwarder string
+  auto functions = img.Read<PDWORD>(descr->AddressOfFunctions);
+  for (DWORD i = 0; i < descr->NumberOfFunctions; ++i) {
+    ordinals_[i] = functions[i] != 0;
+    if (functions[i] < section.VirtualAddress ||
+        functions[i] >= section.VirtualAddress + section.Size) {
+      continue;
+    }
+    const std::string forwarder = img.Read<PCSTR>(functions[i]);
+    const auto dot = forwarder.rfind('.');
+    if (dot == std::string::npos || !dot) continue;
+    const auto alias = forwarder.substr(0, dot) + ".dll";
+    forwarders_.push_back(
+        {utils::lower(PeMeta::Instance().VirtualToLogic(alias)),
+         alias, forwarder.substr(dot + 1)});
+  }
+  names_.reserve(descr->NumberOfNames);
+  for (const auto& name : ordinal_names_) {
+    if (name.size()) names_.insert(name);
+  }
+}
+
+bool PeExports::Has(const std::string& function) const {
+  if (utils::startswith(function, "#")) {
+    const auto ordinal = std::strtoul(function.c_str() + 1, nullptr, 10);
+    return ordinal >= ordinal_base_ &&
+           ordinal - ordinal_base_ < ordinals_.size() &&
+           ordinals_[ordinal - ordinal_base_];
+  }
+  return names_.count(std::string_view(function)) > 0;
+}
+
+DWORD PeExports::Base() const { return ordinal_base_; }
+
+size_t PeExports::Count() const { return ordinal_names_.size(); }
+
+const std::vector<PeForwarder>& PeExports::Forwarders() const {
+  return forwarders_;
+}
+
+const std::string* PeExports::Name(WORD ordinal) const {
+  if (ordinal < ordinal_base_) return nullptr;
+  const auto index = static_cast<size_t>(ordinal - ordinal_base_);
+  if (index >= ordinal_names_.size() || ordinal_names_[index].empty()) {
+    return nullptr;
+  }
+  return &ordinal_names_[index];
+}
+
 PeFunction::PeFunction(const std::string& name,
-                       std::shared_ptr<PeImport> import)
-    : name_(name), import_(import) {}
+                       std::shared_ptr<PeImport> import, ImportKind kind)
+    : name_(name), import_(import) {
+  kinds_ = kind;
+}
 
 std::string PeFunction::String() const {
   if (!import_.expired()) {
@@ -205,36 +834,39 @@ std::string PeFunction::String() const {
 
 const std::string& PeFunction::Name() const { return name_; }
 
-PeImageFactory::PeImageFactory(bool delayed) : delayed_(delayed) {}
+PeImageFactory::PeImageFactory(bool delayed, bool forwarders,
+                               size_t io_threads)
+    : delayed_(delayed), forwarders_(forwarders), loader_(true, io_threads) {}
 
 std::shared_ptr<Image> PeImageFactory::Create(const std::string& image) {
-  auto image_ctx = std::make_shared<PeImage>(image, delayed_);
-  image_ctx->Parse();
+  auto image_ctx = std::make_shared<PeImage>(image, delayed_, forwarders_);
+  image_ctx->Parse(&contents_, &loader_);
   return image_ctx;
 }
 
+void PeImageFactory::Prefetch(const std::vector<std::string>& images) {
+  loader_.Prefetch(images);
+}
+
 PeMeta* PeMeta::instance_ = nullptr;
 
 PeMeta& PeMeta::Instance() {
-  if (!instance_) {
-    instance_ = new PeMeta;
-  }
+  static std::once_flag once;
+  std::call_once(once, [] { instance_ = new PeMeta; });
   return *instance_;
 }
 
-PeMeta::PeMeta() {
-  namespace_array_ = GetApiSetHeader();
-  dll_name_re = std::wregex(L"(\\S+)(-l\\d+-\\d+-\\d+)", std::regex::optimize);
-}
+PeMeta::PeMeta() { namespace_array_ = GetApiSetHeader(); }
 
 PeMeta::~PeMeta() {}
 
 std::string PeMeta::VirtualToLogic(const std::string& virtual_dll) {
-  if (namespace_array_ == NULL || (!utils::startswith(virtual_dll, "api-") &&
-                                   !utils::startswith(virtual_dll, "ext-"))) {
+  if (namespace_array_ == NULL || (!utils::istartswith(virtual_dll, "api-") &&
+                                   !utils::istartswith(virtual_dll, "ext-"))) {
     return virtual_dll;
   }
 
+  std::lock_guard<std::mutex> lock(mutex_);
   auto logic_cache_it = logic_dll_cache_.find(virtual_dll);
   if (logic_cache_it != logic_dll_cache_.end()) {
     return logic_cache_it->second;
@@ -242,34 +874,28 @@ std::string PeMeta::VirtualToLogic(const std::string& virtual_dll) {
 
   API_SET_NAMESPACE_ENTRY* ns_entry = namespace_array_->Entries;
 
-  auto logic_dll = utils::a2w(virtual_dll);
-  auto ext_start = logic_dll.find(L'.');
-  if (ext_start != std::string::npos) {
-    logic_dll = logic_dll.substr(0, ext_start);
-  }
-  logic_dll = VersionlessDllName(logic_dll);
+  // Names are compared without extension and version. ApiSet names are read
+  // in place and compared to the narrow name without conversion.
+  std::string_view logic_dll = virtual_dll;
+  logic_dll = StripApiSetVersion(logic_dll.substr(0, logic_dll.find('.')));
 
   for (uint32_t i = 0; i < namespace_array_->Count; ++i, ++ns_entry) {
     if (ns_entry->NameLength) {
-      std::wstring top_module(ns_entry->NameLength, L'\0');
-      const auto top_ptr = ReadNamespace<const wchar_t*>(ns_entry->NameOffset);
-      memcpy(top_module.data(), top_ptr, ns_entry->NameLength);
-      top_module = VersionlessDllName(std::wstring(top_module.c_str()));
-      if (top_module == logic_dll) {
+      std::wstring_view top_module(
+          ReadNamespace<const wchar_t*>(ns_entry->NameOffset),
+          ns_entry->NameLength / sizeof(wchar_t));
+      top_module = top_module.substr(0, top_module.find(L'\0'));
+      if (utils::iequals(StripApiSetVersion(top_module), logic_dll)) {
         auto hosts = ReadNamespace<API_SET_VALUE_ENTRY*>(ns_entry->DataOffset);
         // Search from the end
         for (int j = ns_entry->HostsCount - 1; j >= 0; j--) {
           auto host = hosts[j];
           auto name_len = host.HostModuleNameLength / sizeof(wchar_t);
           if (name_len) {
-            const auto name_ptr =
-                ReadNamespace<const void*>(host.HostModuleName);
-            logic_dll.resize(name_len, L'\0');
-            auto dst =
-                static_cast<void*>(const_cast<wchar_t*>(logic_dll.data()));
-            memcpy(dst, name_ptr, name_len * sizeof(wchar_t));
-            auto logic_ansii = utils::w2a(logic_dll);
-            logic_dll_cache_[virtual_dll] = logic_ansii;
+            const std::wstring_view host_name(
+                ReadNamespace<const wchar_t*>(host.HostModuleName), name_len);
+            auto& logic_ansii = logic_dll_cache_[virtual_dll];
+            utils::w2a(host_name, &logic_ansii);
             return logic_ansii;
           }
         }
@@ -281,14 +907,56 @@ std::string PeMeta::VirtualToLogic(const std::string& virtual_dll) {
   return virtual_dll;
 }
 
-std::wstring PeMeta::VersionlessDllName(const std::wstring& name) {
-  std::wsmatch groups;
-  if (std::regex_match(name, groups, dll_name_re) && groups.size() > 1) {
-    return groups[1].str();
+std::shared_ptr<const PeExports> PeMeta::Exports(const std::string& dll) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto exports_it = exports_cache_.find(dll);
+    if (exports_it != exports_cache_.end()) {
+      return exports_it->second;
+    }
+  }
+  // Exports are read unlocked, they resolve the forwarders by VirtualToLogic
+  std::shared_ptr<const PeExports> exports;
+  try {
+    LoadedImage loaded_image{dll};
+    exports = std::make_shared<const PeExports>(loaded_image);
+  } catch (const exc::WinDepException&) {
+    // Unresolvable DLLs are cached too, so they are probed only once
   }
-  return name;
+  // Exports read by another thread in the meantime win
+  std::lock_guard<std::mutex> lock(mutex_);
+  return exports_cache_.emplace(dll, exports).first->second;
 }
 
-PeImport::PeImport(const std::string& name, const std::string& alias)
-    : Import(utils::lower(name), alias) {}
+std::shared_ptr<const PeExports> PeMeta::Exports(
+    const std::string& dll, const LoadedImage& loaded_image) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto exports_it = exports_cache_.find(dll);
+    if (exports_it != exports_cache_.end() && exports_it->second) {
+      return exports_it->second;
+    }
+  }
+  auto exports = std::make_shared<const PeExports>(loaded_image);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& cached = exports_cache_[dll];
+  if (!cached) cached = std::move(exports);
+  return cached;
+}
+
+std::wstring PeMeta::VersionlessDllName(const std::wstring& name) {
+  return std::wstring(StripApiSetVersion(std::wstring_view(name)));
+}
+
+void PeMeta::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  logic_dll_cache_.clear();
+  exports_cache_.clear();
+}
+
+PeImport::PeImport(const std::string& name, const std::string& alias,
+                   ImportKind kind)
+    : Import(name, alias, kind) {
+  utils::lower_inplace(&name_);
+}
 }  // namespace windep::image::pe
@@ -4,18 +4,25 @@
 #include <Windows.h>
 #include <winternl.h>
 
+#include <condition_variable>
+#include <exception>
 #include <memory>
-#include <regex>
+#include <mutex>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "exceptions.h"
+#include "flat_hash.h"
 #include "image.h"
 
 namespace windep::image::pe {
 class PeImport : public Import {
  public:
-  PeImport(const std::string& name, const std::string& alias);
+  PeImport(const std::string& name, const std::string& alias,
+           ImportKind kind = ImportKind::kStatic);
 };
 
 class PeFunction : public Function {
@@ -23,23 +30,54 @@ class PeFunction : public Function {
   std::weak_ptr<PeImport> import_;
 
  public:
-  explicit PeFunction(const std::string& name,
-                      std::shared_ptr<PeImport> import);
+  explicit PeFunction(const std::string& name, std::shared_ptr<PeImport> import,
+                      ImportKind kind = ImportKind::kStatic);
   std::string String() const override;
   const std::string& Name() const override;
 };
 
+/*
+  Image file read on demand into the zeroed buffer of the image size, so the
+  data is addressed by RVAs as in the image mapped by the loader. Only the
+  headers, the import, delay-import and export directories and the tables
+  and names they point to are read. Pages are fetched in rounds: every round
+  collects the pages the next tables need and reads them by positioned reads,
+  coalescing the close pages of the same section into one read.
+*/
 class LoadedImage {
-  HMODULE image_handle_ = nullptr;
+  static constexpr DWORD kPageSize = 0x1000;
+  // Unneeded pages between the needed ones, which are read to save a read
+  static constexpr DWORD kMaxGap = 2;
+
+  HANDLE file_ = INVALID_HANDLE_VALUE;
   LPVOID image_view_ = nullptr;
+  DWORD image_size_ = 0;
+  ULONGLONG file_size_ = 0;
   PIMAGE_DOS_HEADER dos_header_ = nullptr;
   union {
     PIMAGE_NT_HEADERS32 x32 = nullptr;
     PIMAGE_NT_HEADERS64 x64;
   } nt_headers_;
   PIMAGE_SECTION_HEADER section_headers_ = nullptr;
-  PIMAGE_SECTION_HEADER last_section_ = nullptr;
   std::string name_;
+  std::wstring path_;
+  // Pages of the view, which are already read
+  std::vector<bool> pages_;
+  size_t bytes_read_ = 0;
+  size_t reads_ = 0;
+
+  void Release();
+  DWORD ReadAt(ULONGLONG offset, DWORD size, LPVOID buffer);
+  void ReadHeaders();
+  // Reads [begin, end) RVAs, separately for the headers and every section
+  void ReadRange(DWORD begin, DWORD end);
+  bool Loaded(DWORD rva, DWORD size) const;
+  // Reads the pages of the RVA ranges, which are not read yet
+  void Fetch(const std::vector<std::pair<DWORD, DWORD>>& ranges);
+  // Reads the arrays of the element sizes at the RVAs until the zeroed
+  // element, e.g. strings, thunks and descriptors
+  void FetchTerminated(std::vector<std::pair<DWORD, DWORD>> arrays);
+  void Prefetch();
 
  public:
   explicit LoadedImage(const std::string& name);
@@ -56,25 +94,140 @@ class LoadedImage {
   const PIMAGE_FILE_HEADER FileHeader() const;
   const PIMAGE_DATA_DIRECTORY DataDirectory() const;
   std::wstring Path() const;
+  // Bytes and reads issued for the image file, e.g. to compare with its size
+  size_t BytesRead() const;
+  size_t Reads() const;
+  // Hash of the read pages and the file size. Images with the same read
+  // pages have the same imports, so the rest of the file is not read.
+  uint64_t Fingerprint() const;
+};
+
+// Export forwarded to another DLL, e.g. 'NTDLL.RtlAllocateHeap'
+struct PeForwarder {
+  std::string dll;
+  std::string alias;
+  std::string function;
+};
+
+// Ordinal->name, name lookup and forwarders tables of the image export
+// directory. Built once per DLL by PeMeta and shared by every importer.
+class PeExports {
+  DWORD ordinal_base_ = 0;
+  std::vector<std::string> ordinal_names_;
+  std::vector<bool> ordinals_;
+  // Views into ordinal_names_, which is not modified after construction
+  FlatHashSet<std::string_view> names_;
+  std::vector<PeForwarder> forwarders_;
+
+ public:
+  explicit PeExports(const LoadedImage& loaded_image);
+  PeExports(const PeExports&) = delete;
+  PeExports& operator=(const PeExports&) = delete;
+  DWORD Base() const;
+  size_t Count() const;
+  const std::string* Name(WORD ordinal) const;
+  const std::vector<PeForwarder>& Forwarders() const;
+  // Accepts both function names and '#ordinal' names of unnamed imports
+  bool Has(const std::string& function) const;
+};
+
+// Image file read ahead with its fingerprint, or the read error
+struct PeLoad {
+  std::unique_ptr<LoadedImage> image;
+  uint64_t fingerprint = 0;
+  std::exception_ptr error;
+};
+
+PeLoad Load(const std::string& image, bool fingerprint);
+
+/*
+  Reads the images ahead on the worker threads, so the files of the whole
+  dependency frontier are opened and read concurrently while the images are
+  parsed one by one. The newest prefetched image is read first, as the depth
+  first traversal needs it next. Image, which is still queued when it is
+  taken, is read by the caller instead of waiting for the workers.
+*/
+class PeLoader {
+  enum class State : uint8_t { kQueued, kLoading, kLoaded };
+  struct Slot {
+    State state = State::kQueued;
+    PeLoad load;
+  };
+
+  const bool fingerprints_;
+  const size_t threads_;
+  std::mutex mutex_;
+  std::condition_variable queued_;
+  std::condition_variable loaded_;
+  // Images to read, the last one is read first
+  std::vector<std::string> queue_;
+  // Slots by the case insensitive image names
+  FlatHashMap<std::string, Slot, IStringHash, IStringEq> slots_;
+  std::vector<std::thread> workers_;
+  bool stop_ = false;
+  void Work();
+
+ public:
+  // Reads are bound by the I/O latency rather than by CPU, so there are more
+  // workers than cores on the most machines
+  static constexpr size_t kThreads = 16;
+
+  explicit PeLoader(bool fingerprints, size_t threads = kThreads);
+  ~PeLoader();
+  PeLoader(const PeLoader&) = delete;
+  PeLoader& operator=(const PeLoader&) = delete;
+  void Prefetch(const std::vector<std::string>& images);
+  // Prefetched image or the image read right away, if it is not prefetched
+  PeLoad Take(const std::string& image);
+};
+
+// Imports parsed from the image content, by the content fingerprint. Shared
+// by the images parsed concurrently.
+class PeContents {
+  std::mutex mutex_;
+  FlatHashMap<uint64_t, Image::ImportsCollection> imports_;
+
+ public:
+  bool Find(uint64_t fingerprint, Image::ImportsCollection* imports);
+  void Add(uint64_t fingerprint, const Image::ImportsCollection& imports);
 };
 
 class PeImage : public Image {
   bool delayed_ = false;
+  bool forwarders_ = true;
+  std::shared_ptr<const PeExports> exports_;
+  size_t bytes_read_ = 0;
   Image::ImportsCollection ParseImports(const LoadedImage& loaded_image) const;
   Image::ImportsCollection ParseDelayedImports(
       const LoadedImage& loaded_image) const;
+  Image::ImportsCollection ParseForwarders(
+      const LoadedImage& loaded_image) const;
 
  public:
-  PeImage(const std::string& name, bool delayed);
+  PeImage(const std::string& name, bool delayed, bool forwarders = true);
   void Parse() override;
+  // Copies of the already parsed content at the other paths reuse its
+  // imports instead of parsing them again. Loader provides the image read
+  // ahead, if it is given.
+  void Parse(PeContents* contents, PeLoader* loader = nullptr);
+  bool HasExport(const std::string& function) const override;
+  // Bytes read from the image file by the last parse
+  size_t BytesRead() const;
 };
 
+// Create is thread safe, images are parsed concurrently by the pipeline
 class PeImageFactory : public ImageContextFactory {
   bool delayed_;
+  bool forwarders_;
+  PeContents contents_;
+  PeLoader loader_;
 
  public:
-  explicit PeImageFactory(bool delayed = false);
+  // Images are not read ahead if io_threads is 0
+  explicit PeImageFactory(bool delayed = false, bool forwarders = true,
+                          size_t io_threads = PeLoader::kThreads);
   std::shared_ptr<Image> Create(const std::string& image) override;
+  void Prefetch(const std::vector<std::string>& images) override;
 };
 
 #define MKPTR(p1, p2) ((DWORD_PTR)(p1) + (DWORD_PTR)(p2))
@@ -141,8 +294,13 @@ using pfnNtQueryInformationProcess =
 class PeMeta {
   static PeMeta* instance_;
   API_SET_NAMESPACE_ARRAY* namespace_array_;
-  std::unordered_map<std::string, std::string> logic_dll_cache_;
-  std::wregex dll_name_re;
+  // Guards the caches, which are shared by the concurrently parsed images
+  std::mutex mutex_;
+  FlatHashMap<std::string, std::string, IStringHash, IStringEq>
+      logic_dll_cache_;
+  FlatHashMap<std::string, std::shared_ptr<const PeExports>, IStringHash,
+              IStringEq>
+      exports_cache_;
 
   PeMeta();
   ~PeMeta();
@@ -159,6 +317,11 @@ class PeMeta {
  public:
   static PeMeta& Instance();
   std::string VirtualToLogic(const std::string& virtual_dll);
+  std::shared_ptr<const PeExports> Exports(const std::string& dll);
+  std::shared_ptr<const PeExports> Exports(const std::string& dll,
+                                           const LoadedImage& loaded_image);
   std::wstring VersionlessDllName(const std::wstring& name);
+  // Drops the cached exports and resolved ApiSet names
+  void Clear();
 };
 }  // namespace windep::image::pe
@@ -0,0 +1,144 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#include "query.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "exceptions.h"
+#include "flat_hash.h"
+#include "utils.h"
+
+namespace windep::query {
+namespace {
+struct Entry {
+  std::string name;
+  size_t depth;
+  // Images of the previous level importing this one
+  std::vector<std::pair<size_t, std::shared_ptr<image::Import>>> preds;
+};
+
+bool Matches(const image::Import& import, const Target& target) {
+  if (target.image.size() && !utils::iequals(import.Name(), target.image) &&
+      !utils::iequals(import.Alias(), target.image)) {
+    return false;
+  }
+  if (target.function.empty()) return true;
+  for (const auto& func : import.Functions()) {
+    if (func->Name() == target.function) return true;
+  }
+  return false;
+}
+
+// Walks predecessors back to the root, suffix holds the steps in reverse
+void Collect(const std::vector<Entry>& entries, size_t index, size_t limit,
+             Chain* suffix, std::vector<Chain>* chains) {
+  if (chains->size() >= limit) return;
+  const auto& entry = entries[index];
+  if (entry.preds.empty()) {
+    Chain chain{{entry.name, nullptr}};
+    chain.insert(chain.end(), suffix->rbegin(), suffix->rend());
+    chains->push_back(std::move(chain));
+    return;
+  }
+  for (const auto& [pred, import] : entry.preds) {
+    suffix->push_back({entry.name, import});
+    Collect(entries, pred, limit, suffix, chains);
+    suffix->pop_back();
+  }
+}
+}  // namespace
+
+Target Target::Parse(const std::string& target) {
+  Target parsed;
+  const auto separator = target.find('!');
+  parsed.image = target.substr(0, separator);
+  if (separator != std::string::npos) {
+    parsed.function = target.substr(separator + 1);
+  }
+  if (parsed.image.empty() && parsed.function.empty()) {
+    throw exc::Validation("Empty query target");
+  }
+  return parsed;
+}
+
+std::string Target::String() const {
+  return function.empty() ? image : image + '!' + function;
+}
+
+ChainQuery::ChainQuery(
+    std::shared_ptr<image::ImageContextFactory> image_factory,
+    size_t max_chains)
+    : image_factory_(std::move(image_factory)), max_chains_(max_chains) {}
+
+std::vector<Chain> ChainQuery::Find(const std::string& root,
+                                    const Target& target) {
+  expanded_ = 0;
+  if (target.function.empty() && utils::iequals(root, target.image)) {
+    return {{{root, nullptr}}};
+  }
+  std::vector<Entry> entries{{root, 0, {}}};
+  FlatHashMap<std::string, size_t, IStringHash, IStringEq> index;
+  index[root] = 0;
+  // Importers of the target and their imports
+  std::vector<std::pair<size_t, std::shared_ptr<image::Import>>> matches;
+  size_t level_begin = 0;
+  while (level_begin < entries.size() && matches.empty()) {
+    const auto level_end = entries.size();
+    for (auto i = level_begin; i < level_end; ++i) {
+      std::shared_ptr<image::Image> image_ctx;
+      try {
+        image_ctx = image_factory_->Create(entries[i].name);
+      } catch (const exc::WinDepException&) {
+        // Root must be opened, unresolved imports are skipped
+        if (!i) throw;
+        continue;
+      }
+      expanded_++;
+      const auto depth = entries[i].depth + 1;
+      for (const auto& import : image_ctx->Imports()) {
+        if (Matches(*import, target)) {
+          matches.emplace_back(i, import);
+          continue;
+        }
+        const auto [index_it, inserted] =
+            index.emplace(import->Name(), entries.size());
+        if (inserted) {
+          entries.push_back({import->Name(), depth, {{i, import}}});
+        } else if (entries[index_it->second].depth == depth) {
+          entries[index_it->second].preds.emplace_back(i, import);
+        }
+      }
+    }
+    level_begin = level_end;
+  }
+  std::vector<Chain> chains;
+  Chain suffix;
+  for (const auto& [importer, import] : matches) {
+    suffix.push_back({import->Name(), import});
+    Collect(entries, importer, max_chains_, &suffix, &chains);
+    suffix.pop_back();
+  }
+  return chains;
+}
+
+size_t ChainQuery::Expanded() const { return expanded_; }
+
+std::string Format(const Chain& chain, const Target& target) {
+  std::string line;
+  for (size_t i = 0; i < chain.size(); ++i) {
+    const auto& step = chain[i];
+    if (i) line += " -> ";
+    line += step.image;
+    if (i + 1 == chain.size() && target.function.size()) {
+      line += '!' + target.function;
+    }
+    if (step.import && !utils::iequals(step.import->Alias(), step.image)) {
+      line += " (" + step.import->Alias() + ')';
+    }
+  }
+  return line;
+}
+}  // namespace windep::query
@@ -0,0 +1,47 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+namespace windep::query {
+// Image and/or function written as "dll", "dll!function" or "!function"
+struct Target {
+  std::string image;
+  std::string function;
+  static Target Parse(const std::string& target);
+  std::string String() const;
+};
+
+struct Step {
+  std::string image;
+  // How the previous step imports the image, nullptr for the root
+  std::shared_ptr<image::Import> import;
+};
+using Chain = std::vector<Step>;
+
+/*
+  Answers why the image or function is loaded. Images are parsed breadth
+  first level by level, so the search stops right after the level where the
+  target is imported and the deeper images are never opened. All chains of
+  the shortest length are returned, up to the limit.
+*/
+class ChainQuery {
+  std::shared_ptr<image::ImageContextFactory> image_factory_;
+  size_t max_chains_;
+  size_t expanded_ = 0;
+
+ public:
+  explicit ChainQuery(std::shared_ptr<image::ImageContextFactory> image_factory,
+                      size_t max_chains = 16);
+  std::vector<Chain> Find(const std::string& root, const Target& target);
+  // Number of the images parsed by the last search
+  size_t Expanded() const;
+};
+
+// Single line, e.g. "app.exe -> kernelbase.dll (api-ms-win-core-...)"
+std::string Format(const Chain& chain, const Target& target);
+}  // namespace windep::query
@@ -0,0 +1,142 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+// Winsock 2 has to precede Windows.h, which pulls the legacy winsock.h
+#include <winsock2.h>
+#include <afunix.h>
+
+#include "server.h"
+
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "exceptions.h"
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace windep::server {
+namespace {
+bool SendAll(SOCKET client, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const auto result = ::send(client, data.data() + sent,
+                               static_cast<int>(data.size() - sent), 0);
+    if (result == SOCKET_ERROR) return false;
+    sent += static_cast<size_t>(result);
+  }
+  return true;
+}
+
+void ServeClient(Server* server, SOCKET client) {
+  std::string pending;
+  char buffer[4096];
+  int received;
+  while ((received = ::recv(client, buffer, sizeof(buffer), 0)) > 0) {
+    pending.append(buffer, static_cast<size_t>(received));
+    size_t newline;
+    while ((newline = pending.find('\n')) != std::string::npos) {
+      const auto response = server->Handle(pending.substr(0, newline)) + '\n';
+      pending.erase(0, newline + 1);
+      if (!SendAll(client, response)) return;
+    }
+  }
+}
+}  // namespace
+
+json Server::HandleRequest(const json& request) {
+  const auto command = request.value("command", std::string("analyze"));
+  if (command == "clear") {
+    Clear();
+    return {{"output", ""}};
+  } else if (command == "dependents") {
+    const auto index = session_.Index(
+        request.at("images").get<std::vector<std::string>>(),
+        {request.value("delayed", false), request.value("forwarders", true)});
+    return {{"output",
+             index->Dependents(request.at("target").get<std::string>())}};
+  } else if (command != "analyze" && command != "why" &&
+             command != "gateways") {
+    throw exc::Validation("Unsupported command: " + command);
+  }
+  const auto image = request.at("image").get<std::string>();
+  session::Options options;
+  options.delayed = request.value("delayed", options.delayed);
+  options.forwarders = request.value("forwarders", options.forwarders);
+  if (command == "why") {
+    const auto target =
+        query::Target::Parse(request.at("target").get<std::string>());
+    std::vector<std::string> chains;
+    for (const auto& chain : session_.Why(image, target, options)) {
+      chains.push_back(query::Format(chain, target));
+    }
+    return {{"output", chains}};
+  }
+  session::RenderOptions render;
+  render.format = request.value("format", render.format);
+  render.functions = request.value("functions", render.functions);
+  render.indent = request.value("indent", render.indent);
+  const auto graph = session_.Analyze(image, options);
+  if (command == "gateways") {
+    return {{"output",
+             graph->Gateways(request.at("target").get<std::string>())}};
+  }
+  return {{"output", graph->Render(render)}};
+}
+
+std::string Server::Handle(const std::string& line) {
+  json response = json::object();
+  try {
+    const auto request = json::parse(line);
+    if (request.contains("id")) response["id"] = request["id"];
+    response.update(HandleRequest(request));
+  } catch (const std::exception& e) {
+    response["error"] = e.what();
+  }
+  return response.dump();
+}
+
+void Server::Serve(std::istream& input, std::ostream& output) {
+  std::string line;
+  while (std::getline(input, line)) {
+    if (line.size() && line.back() == '\r') line.pop_back();
+    if (line.empty()) continue;
+    // Flushed after every response, the client waits for it
+    output << Handle(line) << std::endl;
+  }
+}
+
+void Server::Listen(const std::string& socket_path) {
+  WSADATA wsa_data;
+  if (::WSAStartup(MAKEWORD(2, 2), &wsa_data)) {
+    throw exc::WinException("Failed to initialize Winsock");
+  }
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    ::WSACleanup();
+    throw exc::Validation("Socket path is too long: " + socket_path);
+  }
+  std::memcpy(address.sun_path, socket_path.data(), socket_path.size());
+  // Socket file of the previous run prevents binding
+  ::DeleteFileA(socket_path.c_str());
+  auto listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener == INVALID_SOCKET ||
+      ::bind(listener, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) == SOCKET_ERROR ||
+      ::listen(listener, SOMAXCONN) == SOCKET_ERROR) {
+    if (listener != INVALID_SOCKET) ::closesocket(listener);
+    ::WSACleanup();
+    throw exc::WinException("Failed to listen on " + socket_path);
+  }
+  SOCKET client;
+  while ((client = ::accept(listener, nullptr, nullptr)) != INVALID_SOCKET) {
+    ServeClient(this, client);
+    ::closesocket(client);
+  }
+  ::closesocket(listener);
+  ::WSACleanup();
+}
+
+void Server::Clear() { session_.Clear(); }
+}  // namespace windep::server
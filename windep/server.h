@@ -0,0 +1,39 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#pragma once
+#include <iostream>
+#include <string>
+
+#include "json/json.hpp"
+#include "session.h"
+
+namespace windep::server {
+using nlohmann::json;
+/*
+  Long running analysis server. Parsed images and built graphs stay resident
+  between requests, so repeated analysis of the same system DLLs costs only
+  the rendering. Every request is a single JSON line:
+    {"id": 1, "image": "kernel32.dll", "format": "json", "functions": true,
+     "delayed": false, "forwarders": true, "indent": 2}
+  and is answered with a JSON line with the same "id" and either "output",
+  which holds the text the CLI would print, or "error".
+  {"command": "why", "image": "app.exe", "target": "ntdll.dll"} returns the
+  shortest import chains as an "output" array, "gateways" command with the
+  same fields returns the images which are on every chain to the target.
+  {"command": "dependents", "images": ["a.exe", "b.exe"], "target": "x.dll"}
+  returns the images, which depend on the target.
+  {"command": "clear"} drops the caches, e.g. after the system update.
+*/
+class Server {
+  session::Session session_;
+  json HandleRequest(const json& request);
+
+ public:
+  std::string Handle(const std::string& line);
+  // JSON lines over the streams, e.g. stdin/stdout
+  void Serve(std::istream& input, std::ostream& output);
+  // JSON lines over the Unix domain socket, clients are served one by one
+  void Listen(const std::string& socket_path);
+  void Clear();
+};
+}  // namespace windep::server
@@ -0,0 +1,280 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#include "session.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "exceptions.h"
+#include "graph.h"
+#include "pe.h"
+#include "traversing.h"
+#include "utils.h"
+#include "view.h"
+
+namespace windep::session {
+namespace {
+using NodesCollection =
+    FlatHashMap<std::string, std::shared_ptr<Dependency<image::Image>>,
+                IStringHash, IStringEq>;
+
+class IndexVisitor : public TreeVisitor<image::Image> {
+  NodesCollection* nodes_;
+
+ public:
+  explicit IndexVisitor(NodesCollection* nodes) : nodes_(nodes) {}
+  void Visit(std::shared_ptr<Dependency<image::Image>> node,
+             size_t height) override {
+    nodes_->emplace(node->GetContext()->Name(), node);
+  }
+};
+}  // namespace
+
+Graph::Graph(std::shared_ptr<Dependency<image::Image>> root)
+    : root_(std::move(root)) {
+  Dfs<image::Image>().Traverse(root_, std::make_shared<IndexVisitor>(&nodes_));
+}
+
+std::shared_ptr<Dependency<image::Image>> Graph::Root() const { return root_; }
+
+size_t Graph::Size() const { return nodes_.size(); }
+
+std::shared_ptr<Dependency<image::Image>> Graph::Find(
+    const std::string& image) const {
+  auto node_it = nodes_.find(image);
+  return node_it == nodes_.end() ? nullptr : node_it->second;
+}
+
+std::vector<std::string> Graph::Gateways(const std::string& image) const {
+  const graph::IndexedGraph<image::Image> indexed{root_};
+  for (size_t node = 0; node < indexed.Size(); ++node) {
+    if (!utils::iequals(indexed.Node(node)->GetContext()->Name(), image)) {
+      continue;
+    }
+    const auto idoms = graph::ImmediateDominators(indexed.Edges());
+    std::vector<std::string> gateways;
+    for (const auto dominator : graph::DominatorChain(idoms, node)) {
+      gateways.push_back(indexed.Node(dominator)->GetContext()->Name());
+    }
+    return gateways;
+  }
+  throw exc::NotFound("Image '" + image + "' is not in the graph");
+}
+
+void Graph::Render(const RenderOptions& options,
+                   std::shared_ptr<writer::Writer> writer) const {
+  view::Factory{options.format}
+      .Create(options.functions, options.indent)
+      ->Show(root_, writer);
+}
+
+std::string Graph::Render(const RenderOptions& options) const {
+  auto writer = std::make_shared<writer::StringWriter>();
+  Render(options, writer);
+  return writer->String();
+}
+
+void Graph::Render(
+    const std::vector<
+        std::pair<RenderOptions, std::shared_ptr<writer::Writer>>>& outputs)
+    const {
+  view::FanOut fan_out;
+  for (const auto& [options, writer] : outputs) {
+    fan_out.Add(view::Factory{options.format}.Create(options.functions,
+                                                     options.indent),
+                writer);
+  }
+  fan_out.Show(root_);
+}
+
+ClosureIndex::ClosureIndex(
+    const std::vector<std::string>& roots,
+    const std::vector<std::shared_ptr<Dependency<image::Image>>>& root_nodes)
+    : graph_(root_nodes),
+      reachability_(graph::StronglyConnected(graph_.Edges())) {
+  for (size_t node = 0; node < graph_.Size(); ++node) {
+    nodes_.emplace(graph_.Node(node)->GetContext()->Name(), node);
+  }
+  for (size_t i = 0; i < roots.size(); ++i) {
+    // Roots are the first nodes, unless one is imported by the previous root
+    const auto node = Node(root_nodes[i]->GetContext()->Name());
+    nodes_.emplace(roots[i], node);
+    roots_.emplace_back(roots[i], node);
+  }
+}
+
+size_t ClosureIndex::Node(const std::string& image) const {
+  auto node_it = nodes_.find(image);
+  if (node_it == nodes_.end()) {
+    throw exc::NotFound("Image '" + image + "' is not in the graph");
+  }
+  return node_it->second;
+}
+
+std::vector<std::string> ClosureIndex::Names(
+    const graph::Bitset& closure) const {
+  std::vector<std::string> names;
+  for (const auto node : reachability_.Nodes(closure)) {
+    names.push_back(graph_.Node(node)->GetContext()->Name());
+  }
+  return names;
+}
+
+bool ClosureIndex::Depends(const std::string& root,
+                           const std::string& image) const {
+  auto image_it = nodes_.find(image);
+  return image_it != nodes_.end() &&
+         reachability_.Reaches(Node(root), image_it->second);
+}
+
+size_t ClosureIndex::ClosureSize(const std::string& root) const {
+  return reachability_.ClosureSize(Node(root));
+}
+
+std::vector<std::string> ClosureIndex::Dependents(
+    const std::string& image) const {
+  std::vector<std::string> dependents;
+  auto image_it = nodes_.find(image);
+  if (image_it == nodes_.end()) return dependents;
+  for (const auto& [root, node] : roots_) {
+    if (reachability_.Reaches(node, image_it->second)) {
+      dependents.push_back(root);
+    }
+  }
+  return dependents;
+}
+
+std::vector<std::string> ClosureIndex::Union(const std::string& l,
+                                             const std::string& r) const {
+  auto closure = reachability_.Closure(Node(l));
+  closure |= reachability_.Closure(Node(r));
+  return Names(closure);
+}
+
+std::vector<std::string> ClosureIndex::Intersection(
+    const std::string& l, const std::string& r) const {
+  auto closure = reachability_.Closure(Node(l));
+  closure &= reachability_.Closure(Node(r));
+  return Names(closure);
+}
+
+std::vector<std::string> ClosureIndex::Difference(
+    const std::string& l, const std::string& r) const {
+  auto closure = reachability_.Closure(Node(l));
+  closure -= reachability_.Closure(Node(r));
+  return Names(closure);
+}
+
+std::shared_ptr<image::CachingImageFactory> Session::ImageFactory(
+    const Options& options) {
+  auto& image_factory = image_factories_[{options.delayed, options.forwarders}];
+  if (!image_factory) {
+    image_factory = std::make_shared<image::CachingImageFactory>(
+        std::make_shared<image::pe::PeImageFactory>(options.delayed,
+                                                    options.forwarders));
+  }
+  return image_factory;
+}
+
+std::string Session::GraphKey(const std::string& root,
+                              const Options& options) {
+  return root + '|' + std::to_string(options.delayed) +
+         std::to_string(options.forwarders);
+}
+
+std::shared_ptr<const Graph> Session::Analyze(const std::string& root,
+                                              const Options& options) {
+  const auto key = GraphKey(root, options);
+  auto graph_it = graphs_.find(key);
+  if (graph_it != graphs_.end()) {
+    return graph_it->second;
+  }
+  image::ImageDependencyFactory dep_factory{root, ImageFactory(options)};
+  std::shared_ptr<const Graph> graph =
+      std::make_shared<Graph>(dep_factory.Create());
+  graphs_[key] = graph;
+  return graph;
+}
+
+std::shared_ptr<const Graph> Session::Stream(
+    const std::string& root, const Options& options,
+    const std::vector<std::pair<RenderOptions,
+                                std::shared_ptr<writer::Writer>>>& outputs) {
+  view::FanOut fan_out;
+  for (const auto& [render_options, writer] : outputs) {
+    fan_out.Add(view::Factory{render_options.format}.Create(
+                    render_options.functions, render_options.indent),
+                writer);
+  }
+  // Formats are validated even if the graph is already analyzed
+  auto visitor = fan_out.Stream();
+  const auto key = GraphKey(root, options);
+  auto graph_it = graphs_.find(key);
+  if (graph_it != graphs_.end()) {
+    fan_out.Show(graph_it->second->Root());
+    return graph_it->second;
+  }
+  image::PipelineDependencyFactory dep_factory{root, ImageFactory(options),
+                                               visitor};
+  auto root_node = dep_factory.Create();
+  fan_out.Finish(root_node);
+  std::shared_ptr<const Graph> graph = std::make_shared<Graph>(root_node);
+  graphs_[key] = graph;
+  return graph;
+}
+
+std::shared_ptr<const ClosureIndex> Session::Index(
+    const std::vector<std::string>& roots, const Options& options,
+    std::vector<std::string>* failed) {
+  if (roots.empty()) throw exc::Validation("No roots to index");
+  auto key = std::to_string(options.delayed) +
+             std::to_string(options.forwarders);
+  for (const auto& root : roots) key += '|' + root;
+  auto index_it = indexes_.find(key);
+  if (index_it != indexes_.end()) {
+    return index_it->second;
+  }
+  // One factory for all roots, so the shared dependencies are the same nodes
+  image::ImageDependencyFactory dep_factory{roots.front(),
+                                            ImageFactory(options)};
+  std::vector<std::string> opened;
+  std::vector<std::shared_ptr<Dependency<image::Image>>> root_nodes;
+  for (const auto& root : roots) {
+    try {
+      root_nodes.push_back(dep_factory.Create(root));
+      opened.push_back(root);
+    } catch (const exc::WinDepException&) {
+      if (!failed) throw;
+      failed->push_back(root);
+    }
+  }
+  if (opened.empty()) throw exc::NotFound("None of the roots can be opened");
+  std::shared_ptr<const ClosureIndex> index =
+      std::make_shared<ClosureIndex>(opened, root_nodes);
+  indexes_[key] = index;
+  return index;
+}
+
+std::vector<query::Chain> Session::Why(const std::string& root,
+                                       const query::Target& target,
+                                       const Options& options) {
+  return query::ChainQuery{ImageFactory(options)}.Find(root, target);
+}
+
+size_t Session::CachedImages() const {
+  size_t count = 0;
+  for (const auto& [options, image_factory] : image_factories_) {
+    count += image_factory->Size();
+  }
+  return count;
+}
+
+void Session::Clear() {
+  graphs_.clear();
+  indexes_.clear();
+  image_factories_.clear();
+  image::pe::PeMeta::Instance().Clear();
+}
+}  // namespace windep::session
@@ -0,0 +1,128 @@
+// copyright MIT License Copyright (c) 2022, Albert Farrakhov
+
+#pragma once
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dependency.h"
+#include "flat_hash.h"
+#include "graph.h"
+#include "image.h"
+#include "query.h"
+#include "writer.h"
+
+namespace windep::session {
+struct Options {
+  bool delayed = false;
+  bool forwarders = true;
+};
+
+struct RenderOptions {
+  std::string format = "ascii";
+  bool functions = false;
+  uint8_t indent = 2;
+};
+
+// Analyzed dependency graph, which can be queried or rendered by the views
+class Graph {
+  std::shared_ptr<Dependency<image::Image>> root_;
+  FlatHashMap<std::string, std::shared_ptr<Dependency<image::Image>>,
+              IStringHash, IStringEq>
+      nodes_;
+
+ public:
+  explicit Graph(std::shared_ptr<Dependency<image::Image>> root);
+  std::shared_ptr<Dependency<image::Image>> Root() const;
+  // Number of the unique images in the graph
+  size_t Size() const;
+  // Returns nullptr if the image is not in the graph
+  std::shared_ptr<Dependency<image::Image>> Find(
+      const std::string& image) const;
+  // Images on every import chain from the root to the image, starting from
+  // the root. Throws NotFound if the image is not in the graph.
+  std::vector<std::string> Gateways(const std::string& image) const;
+  void Render(const RenderOptions& options,
+              std::shared_ptr<writer::Writer> writer) const;
+  std::string Render(const RenderOptions& options) const;
+  // Many outputs at the cost of one traversal per traversal order
+  void Render(const std::vector<std::pair<RenderOptions,
+                                          std::shared_ptr<writer::Writer>>>&
+                  outputs) const;
+};
+
+// Dependencies of many roots at once, e.g. all binaries of the product.
+// Built once over the shared graph, every query is answered from bitsets.
+class ClosureIndex {
+  graph::IndexedGraph<image::Image> graph_;
+  graph::Reachability reachability_;
+  std::vector<std::pair<std::string, size_t>> roots_;
+  FlatHashMap<std::string, size_t, IStringHash, IStringEq> nodes_;
+  // Throws NotFound if the image is not in the graph
+  size_t Node(const std::string& image) const;
+  std::vector<std::string> Names(const graph::Bitset& closure) const;
+
+ public:
+  ClosureIndex(const std::vector<std::string>& roots,
+               const std::vector<std::shared_ptr<Dependency<image::Image>>>&
+                   root_nodes);
+  bool Depends(const std::string& root, const std::string& image) const;
+  // Number of the images in the closure of the root, including itself
+  size_t ClosureSize(const std::string& root) const;
+  // Roots, which depend on the image
+  std::vector<std::string> Dependents(const std::string& image) const;
+  // Set algebra over the closures of two roots
+  std::vector<std::string> Union(const std::string& l,
+                                 const std::string& r) const;
+  std::vector<std::string> Intersection(const std::string& l,
+                                        const std::string& r) const;
+  std::vector<std::string> Difference(const std::string& l,
+                                      const std::string& r) const;
+};
+
+/*
+  Entry point for the embedding applications. Session keeps parsed images
+  and analyzed graphs, so only the first analysis of the image pays for the
+  parsing, the next ones return the same graph.
+*/
+class Session {
+  // Image factories by the delayed and forwarders options
+  std::map<std::pair<bool, bool>, std::shared_ptr<image::CachingImageFactory>>
+      image_factories_;
+  FlatHashMap<std::string, std::shared_ptr<const Graph>, IStringHash,
+              IStringEq>
+      graphs_;
+  FlatHashMap<std::string, std::shared_ptr<const ClosureIndex>, IStringHash,
+              IStringEq>
+      indexes_;
+  std::shared_ptr<image::CachingImageFactory> ImageFactory(
+      const Options& options);
+  static std::string GraphKey(const std::string& root, const Options& options);
+
+ public:
+  std::shared_ptr<const Graph> Analyze(const std::string& root,
+                                       const Options& options = {});
+  // Analyzes the root by the pipeline and renders the streaming formats,
+  // csv, ndjson, dot and edges, while the graph is still discovered. Records
+  // are in the order the images are parsed rather than in the BFS order.
+  std::shared_ptr<const Graph> Stream(
+      const std::string& root, const Options& options,
+      const std::vector<std::pair<RenderOptions,
+                                  std::shared_ptr<writer::Writer>>>& outputs);
+  // Roots, which can't be parsed, are skipped and collected to the failed
+  // ones if they are given, otherwise the parsing error is thrown
+  std::shared_ptr<const ClosureIndex> Index(
+      const std::vector<std::string>& roots, const Options& options = {},
+      std::vector<std::string>* failed = nullptr);
+  // Shortest import chains from the root to the target
+  std::vector<query::Chain> Why(const std::string& root,
+                                const query::Target& target,
+                                const Options& options = {});
+  // Number of the parsed images, including the failed ones
+  size_t CachedImages() const;
+  // Drops all cached images and graphs, e.g. after the system update
+  void Clear();
+};
+}  // namespace windep::session
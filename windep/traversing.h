@@ -1,13 +1,16 @@
 // copyright MIT License Copyright (c) 2021, Albert Farrakhov
 
 #pragma once
+#include <cstddef>
 #include <deque>
+#include <iterator>
 #include <memory>
-#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "context.h"
 #include "dependency.h"
+#include "flat_hash.h"
 
 namespace windep {
 template <typename T>
@@ -23,37 +26,160 @@ class TraversalStrategy {
                         std::shared_ptr<TreeVisitor<T>> visitor) = 0;
 };
 
+template <typename T>
+class LazyTraversal;
+
+// Input range of the nodes and their heights, which are produced by the
+// traversal as the range is iterated:
+//   for (const auto& [node, height] : dfs.Walk(root)) ...
+template <typename T>
+class TraversalRange {
+  LazyTraversal<T>* traversal_;
+
+ public:
+  class Iterator {
+    // Null at the end of the traversal
+    LazyTraversal<T>* traversal_ = nullptr;
+    std::pair<std::shared_ptr<Dependency<T>>, size_t> current_;
+    void Advance() {
+      if (!traversal_->Next(&current_.first, &current_.second)) {
+        traversal_ = nullptr;
+      }
+    }
+
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::pair<std::shared_ptr<Dependency<T>>, size_t>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+    Iterator() = default;
+    explicit Iterator(LazyTraversal<T>* traversal) : traversal_(traversal) {
+      Advance();
+    }
+    reference operator*() const { return current_; }
+    pointer operator->() const { return &current_; }
+    Iterator& operator++() {
+      Advance();
+      return *this;
+    }
+    bool operator==(const Iterator& other) const {
+      return traversal_ == other.traversal_;
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+  };
+
+  explicit TraversalRange(LazyTraversal<T>* traversal)
+      : traversal_(traversal) {}
+  Iterator begin() { return Iterator{traversal_}; }
+  Iterator end() { return Iterator{}; }
+};
+
+/*
+  Traversal, which produces the nodes on demand. Start sets the root and
+  every Next produces the next node, so the caller can pull the nodes, stop
+  at any of them without walking the rest of the graph or interleave many
+  traversals. Start drops the state of the previous walk, even if it was
+  stopped early. Traverse pushes all nodes to the visitor on top of it.
+*/
+template <typename T>
+class LazyTraversal : public TraversalStrategy<T> {
+ public:
+  virtual void Start(std::shared_ptr<Dependency<T>> root) = 0;
+  // False if there are no more nodes
+  virtual bool Next(std::shared_ptr<Dependency<T>>* node, size_t* height) = 0;
+  void Traverse(std::shared_ptr<Dependency<T>> root,
+                std::shared_ptr<TreeVisitor<T>> visitor) override {
+    Start(root);
+    std::shared_ptr<Dependency<T>> node;
+    size_t height = 0;
+    while (Next(&node, &height)) visitor->Visit(node, height);
+  }
+  TraversalRange<T> Walk(std::shared_ptr<Dependency<T>> root) {
+    Start(root);
+    return TraversalRange<T>{this};
+  }
+};
+
 enum DfsDirection : uint8_t { kToLeaf, kFromLeaf };
+/*
+  Recursion is unrolled into the stack of the entered nodes with their next
+  children, so the traversal can be suspended after every produced node.
+  Node reached again is produced by kToLeaf without its children, e.g. to
+  show the cyclic dependency, and is not produced by kFromLeaf.
+*/
 template <typename T>
-class Dfs : public TraversalStrategy<T> {
+class Dfs : public LazyTraversal<T> {
+  struct Frame {
+    std::shared_ptr<Dependency<T>> node;
+    typename Dependency<T>::ChildrenCollection::const_iterator next;
+    typename Dependency<T>::ChildrenCollection::const_iterator end;
+  };
+
   size_t height_ = 0;
-  std::unordered_set<std::shared_ptr<Dependency<T>>> visited_;
+  FlatHashSet<const Dependency<T>*> visited_;
   DfsDirection direction_;
+  std::vector<Frame> stack_;
+  // Root or child, which is going to be entered
+  std::shared_ptr<Dependency<T>> entering_;
 
  public:
   explicit Dfs(DfsDirection direction = DfsDirection::kToLeaf)
       : direction_(direction) {}
-  void Traverse(std::shared_ptr<Dependency<T>> root,
-                std::shared_ptr<TreeVisitor<T>> visitor) override {
-    if (direction_ == DfsDirection::kToLeaf) visitor->Visit(root, height_);
-    // Avoid infinite recursion due to the cyclic dependency
-    if (!visited_.count(root)) {
-      visited_.insert(root);
-      height_++;
-      for (auto child : root->Children()) {
-        Traverse(child, visitor);
+  void Start(std::shared_ptr<Dependency<T>> root) override {
+    stack_.clear();
+    visited_.clear();
+    height_ = 0;
+    entering_ = std::move(root);
+  }
+  bool Next(std::shared_ptr<Dependency<T>>* node, size_t* height) override {
+    while (true) {
+      if (entering_) {
+        auto entered = std::move(entering_);
+        const auto entered_height = height_;
+        // Avoid infinite recursion due to the cyclic dependency
+        if (visited_.insert(entered.get()).second) {
+          const auto& children = entered->Children();
+          stack_.push_back({entered, children.begin(), children.end()});
+          height_++;
+        }
+        if (direction_ == DfsDirection::kToLeaf) {
+          *node = std::move(entered);
+          *height = entered_height;
+          return true;
+        }
+        continue;
       }
+      if (stack_.empty()) return false;
+      auto& frame = stack_.back();
+      if (frame.next != frame.end) {
+        entering_ = *frame.next;
+        ++frame.next;
+        continue;
+      }
+      auto left = std::move(frame.node);
+      stack_.pop_back();
       if (height_) height_--;
-      if (direction_ == DfsDirection::kFromLeaf) visitor->Visit(root, height_);
+      if (direction_ == DfsDirection::kFromLeaf) {
+        *node = std::move(left);
+        *height = height_;
+        return true;
+      }
     }
   }
 };
 
 template <typename T>
-class Bfs : public TraversalStrategy<T> {
-  std::unordered_set<std::shared_ptr<Dependency<T>>> visited_;
+class Bfs : public LazyTraversal<T> {
+  FlatHashSet<const Dependency<T>*> visited_;
   std::deque<std::pair<std::shared_ptr<Dependency<T>>, size_t>> queue_;
-  std::shared_ptr<TreeVisitor<T>> visitor_;
+
+ public:
+  void Start(std::shared_ptr<Dependency<T>> root) override {
+    queue_.clear();
+    visited_.clear();
+    queue_.emplace_back(std::move(root), 0);
+  }
   /*
     Each node can have more than one parent, including link to self.
     In this case we have to check parents of each child.
@@ -64,33 +190,27 @@ class Bfs : public TraversalStrategy<T> {
      / \ /
     C   D
   */
-  void BfsTraverse() {
+  bool Next(std::shared_ptr<Dependency<T>>* node, size_t* height) override {
     while (queue_.size()) {
-      auto [node, height] = queue_.front();
+      auto [next, next_height] = std::move(queue_.front());
       queue_.pop_front();
       // Avoid infinite recursion due to the cyclic dependency
-      if (!visited_.count(node)) {
-        visited_.insert(node);
-        visitor_->Visit(node, height);
-        for (auto child : node->Children()) {
-          queue_.emplace_back(child, height + 1);
+      if (visited_.insert(next.get()).second) {
+        for (auto child : next->Children()) {
+          queue_.emplace_back(child, next_height + 1);
         }
-        for (auto parent : node->Parents()) {
+        for (auto parent : next->Parents()) {
           if (!parent.expired()) {
-            queue_.emplace_back(parent.lock(), height ? height - 1 : 0);
+            queue_.emplace_back(parent.lock(),
+                                next_height ? next_height - 1 : 0);
           }
         }
+        *node = std::move(next);
+        *height = next_height;
+        return true;
       }
     }
-  }
-
- public:
-  void Traverse(std::shared_ptr<Dependency<T>> root,
-                std::shared_ptr<TreeVisitor<T>> visitor) override {
-    queue_.clear();
-    queue_.emplace_back(root, 0);
-    visitor_ = visitor;
-    BfsTraverse();
+    return false;
   }
 };
 }  // namespace windep
@@ -2,58 +2,286 @@
 
 #include "utils.h"
 
-#include <Windows.h>
-
-#include <algorithm>
-#include <cctype>
+#include <cstring>
 
 #include "exceptions.h"
 
+#if defined(__AVX2__)
+#define WINDEP_AVX2
+#endif
+#if defined(_M_X64) || defined(__SSE2__) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WINDEP_SSE2
+#endif
+#if defined(WINDEP_AVX2) || defined(WINDEP_SSE2)
+#include <immintrin.h>
+#endif
+
 namespace windep::utils {
+namespace {
+constexpr uint64_t kOnes = 0x0101010101010101ull;
+constexpr uint64_t kHighBits = 0x8080808080808080ull;
+
+// Lowers 'A'-'Z' bytes of the word at once, other bytes are kept as is
+uint64_t LowerWord(uint64_t word) {
+  const auto heptets = word & ~kHighBits;
+  const auto above_z = heptets + (0x7f - 'Z') * kOnes;
+  const auto from_a = heptets + (0x80 - 'A') * kOnes;
+  const auto upper = ~word & (from_a ^ above_z) & kHighBits;
+  return word | (upper >> 2);
+}
+
+uint64_t LoadWord(const char* data, size_t size = sizeof(uint64_t)) {
+  uint64_t word = 0;
+  std::memcpy(&word, data, size);
+  return word;
+}
+
+void LowerAscii(char* data, size_t size) {
+  size_t i = 0;
+#if defined(WINDEP_AVX2)
+  const auto before_a256 = _mm256_set1_epi8('A' - 1);
+  const auto after_z256 = _mm256_set1_epi8('Z' + 1);
+  const auto case_bit256 = _mm256_set1_epi8(0x20);
+  for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i)) {
+    auto ptr = reinterpret_cast<__m256i*>(data + i);
+    const auto chunk = _mm256_loadu_si256(ptr);
+    const auto upper = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, before_a256),
+                                        _mm256_cmpgt_epi8(after_z256, chunk));
+    _mm256_storeu_si256(
+        ptr, _mm256_or_si256(chunk, _mm256_and_si256(upper, case_bit256)));
+  }
+#endif
+#if defined(WINDEP_SSE2)
+  const auto before_a = _mm_set1_epi8('A' - 1);
+  const auto after_z = _mm_set1_epi8('Z' + 1);
+  const auto case_bit = _mm_set1_epi8(0x20);
+  for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i)) {
+    auto ptr = reinterpret_cast<__m128i*>(data + i);
+    const auto chunk = _mm_loadu_si128(ptr);
+    const auto upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, before_a),
+                                     _mm_cmplt_epi8(chunk, after_z));
+    _mm_storeu_si128(ptr,
+                     _mm_or_si128(chunk, _mm_and_si128(upper, case_bit)));
+  }
+#endif
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    const auto word = LowerWord(LoadWord(data + i));
+    std::memcpy(data + i, &word, sizeof(word));
+  }
+  for (; i < size; ++i) {
+    if (data[i] >= 'A' && data[i] <= 'Z') {
+      data[i] = static_cast<char>(data[i] | 0x20);
+    }
+  }
+}
+
+void AppendUtf8(uint32_t code, std::string* ansii) {
+  if (code < 0x80) {
+    ansii->push_back(static_cast<char>(code));
+  } else if (code < 0x800) {
+    ansii->push_back(static_cast<char>(0xc0 | (code >> 6)));
+    ansii->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+  } else if (code < 0x10000) {
+    ansii->push_back(static_cast<char>(0xe0 | (code >> 12)));
+    ansii->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+    ansii->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+  } else {
+    ansii->push_back(static_cast<char>(0xf0 | (code >> 18)));
+    ansii->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+    ansii->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+    ansii->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+  }
+}
+
+// Consumes 8 bytes per step, finalized with the MurmurHash3 mixer
+template <bool FoldCase>
+uint64_t HashWords(std::string_view text) {
+  constexpr uint64_t kMul = 0x9e3779b97f4a7c15ull;
+  uint64_t result = text.size() * kMul;
+  const auto* data = text.data();
+  auto size = text.size();
+  for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+    auto word = LoadWord(data);
+    if constexpr (FoldCase) word = LowerWord(word);
+    data += sizeof(word);
+    result = (result ^ word) * kMul;
+    result ^= result >> 29;
+  }
+  if (size) {
+    auto word = LoadWord(data, size);
+    if constexpr (FoldCase) word = LowerWord(word);
+    result = (result ^ word) * kMul;
+  }
+  result = (result ^ (result >> 33)) * 0xff51afd7ed558ccdull;
+  result = (result ^ (result >> 33)) * 0xc4ceb9fe1a85ec53ull;
+  return result ^ (result >> 33);
+}
+}  // namespace
+
 std::string lower(std::string text) {
-  std::transform(text.begin(), text.end(), text.begin(),
-                 [](unsigned char c) { return std::tolower(c); });
+  lower_inplace(&text);
   return text;
 }
 
+void lower_inplace(std::string* text) {
+  LowerAscii(text->data(), text->size());
+}
+
 bool startswith(const std::string& text, const std::string& prefix) {
   return !text.compare(0, prefix.size(), prefix);
 }
 
-std::string w2a(const std::wstring& wide) {
-  auto required_size =
-      ::WideCharToMultiByte(CP_UTF8, WC_ERR_INVALID_CHARS, wide.data(),
-                            static_cast<int>(wide.size()), nullptr, 0, 0, 0);
-  if (!required_size) {
-    auto last_error = ::GetLastError();
-    if (last_error == ERROR_NO_UNICODE_TRANSLATION) {
-      throw exc::Validation("Unable to translate wide char string to ansii");
+bool istartswith(std::string_view text, std::string_view prefix) {
+  return text.size() >= prefix.size() &&
+         iequals(text.substr(0, prefix.size()), prefix);
+}
+
+bool iequals(std::string_view l, std::string_view r) {
+  if (l.size() != r.size()) return false;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= l.size(); i += sizeof(uint64_t)) {
+    if (LowerWord(LoadWord(l.data() + i)) !=
+        LowerWord(LoadWord(r.data() + i))) {
+      return false;
     }
-    return "";
   }
-  std::string ansii(required_size, '\0');
-  ::WideCharToMultiByte(
-      CP_UTF8, WC_ERR_INVALID_CHARS, wide.data(), static_cast<int>(wide.size()),
-      const_cast<LPSTR>(ansii.data()), static_cast<int>(ansii.size()), 0, 0);
+  const auto tail = l.size() - i;
+  return LowerWord(LoadWord(l.data() + i, tail)) ==
+         LowerWord(LoadWord(r.data() + i, tail));
+}
+
+uint64_t hash(std::string_view text) { return HashWords<false>(text); }
+
+uint64_t ihash(std::string_view text) { return HashWords<true>(text); }
+
+std::string w2a(std::wstring_view wide) {
+  std::string ansii;
+  w2a(wide, &ansii);
   return ansii;
 }
 
-std::wstring a2w(const std::string& ansii) {
-  auto required_size =
-      ::MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, ansii.data(),
-                            static_cast<int>(ansii.size()), nullptr, 0);
-  if (!required_size) {
-    auto last_error = ::GetLastError();
-    if (last_error == ERROR_NO_UNICODE_TRANSLATION) {
-      throw exc::Validation("Unable to translate ansii to wide char string");
+void w2a(std::wstring_view wide, std::string* ansii) {
+  // ASCII prefix is narrowed in place, the rest is encoded char by char
+  ansii->resize(wide.size());
+  auto out = ansii->data();
+  size_t i = 0;
+#if defined(WINDEP_SSE2)
+  if constexpr (sizeof(wchar_t) == sizeof(uint16_t)) {
+    constexpr size_t kLanes = sizeof(__m128i) / sizeof(uint16_t);
+    const auto zero = _mm_setzero_si128();
+    const auto non_ascii = _mm_set1_epi16(-0x80);
+    for (; i + 2 * kLanes <= wide.size(); i += 2 * kLanes) {
+      const auto lo =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(wide.data() + i));
+      const auto hi = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(wide.data() + i + kLanes));
+      const auto high_bits = _mm_and_si128(_mm_or_si128(lo, hi), non_ascii);
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(high_bits, zero)) != 0xffff) break;
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                       _mm_packus_epi16(lo, hi));
     }
-    return L"";
   }
-  std::wstring wide(required_size, L'\0');
-  ::MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, ansii.data(),
-                        static_cast<int>(ansii.size()),
-                        const_cast<LPWSTR>(wide.data()),
-                        static_cast<int>(wide.size()));
+#endif
+  for (; i < wide.size() && static_cast<uint32_t>(wide[i]) < 0x80; ++i) {
+    out[i] = static_cast<char>(wide[i]);
+  }
+  ansii->resize(i);
+  for (; i < wide.size(); ++i) {
+    auto code = static_cast<uint32_t>(wide[i]);
+    if constexpr (sizeof(wchar_t) == sizeof(uint16_t)) {
+      if (code >= 0xd800 && code <= 0xdbff && i + 1 < wide.size() &&
+          wide[i + 1] >= 0xdc00 && wide[i + 1] <= 0xdfff) {
+        code = 0x10000 + ((code - 0xd800) << 10) +
+               (static_cast<uint32_t>(wide[++i]) - 0xdc00);
+      }
+    }
+    if ((code >= 0xd800 && code <= 0xdfff) || code > 0x10ffff) {
+      throw exc::Validation("Unable to translate wide char string to ansii");
+    }
+    AppendUtf8(code, ansii);
+  }
+}
+
+std::wstring a2w(std::string_view ansii) {
+  std::wstring wide;
+  a2w(ansii, &wide);
   return wide;
 }
+
+void a2w(std::string_view ansii, std::wstring* wide) {
+  // UTF-8 never takes less bytes than its UTF-16/UTF-32 form has chars
+  wide->resize(ansii.size());
+  auto out = wide->data();
+  size_t i = 0;
+#if defined(WINDEP_SSE2)
+  const auto zero = _mm_setzero_si128();
+  for (; i + sizeof(__m128i) <= ansii.size(); i += sizeof(__m128i)) {
+    const auto chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ansii.data() + i));
+    if (_mm_movemask_epi8(chunk)) break;
+    const auto lo = _mm_unpacklo_epi8(chunk, zero);
+    const auto hi = _mm_unpackhi_epi8(chunk, zero);
+    auto dst = reinterpret_cast<__m128i*>(out + i);
+    if constexpr (sizeof(wchar_t) == sizeof(uint16_t)) {
+      _mm_storeu_si128(dst, lo);
+      _mm_storeu_si128(dst + 1, hi);
+    } else {
+      _mm_storeu_si128(dst, _mm_unpacklo_epi16(lo, zero));
+      _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, zero));
+      _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, zero));
+      _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, zero));
+    }
+  }
+#endif
+  size_t size = i;
+  while (i < ansii.size()) {
+    const auto lead = static_cast<uint8_t>(ansii[i]);
+    if (lead < 0x80) {
+      out[size++] = lead;
+      i++;
+      continue;
+    }
+    const auto length = lead >= 0xf0 ? 4 : lead >= 0xe0 ? 3 : 2;
+    if (lead < 0xc2 || lead > 0xf4 || i + length > ansii.size()) {
+      throw exc::Validation("Unable to translate ansii to wide char string");
+    }
+    uint32_t code = lead & (0x7f >> length);
+    for (int j = 1; j < length; ++j) {
+      const auto next = static_cast<uint8_t>(ansii[i + j]);
+      if ((next & 0xc0) != 0x80) {
+        throw exc::Validation("Unable to translate ansii to wide char string");
+      }
+      code = (code << 6) | (next & 0x3f);
+    }
+    // Overlong forms, surrogates and out of range code points are invalid
+    if ((length == 3 && code < 0x800) || (length == 4 && code < 0x10000) ||
+        (code >= 0xd800 && code <= 0xdfff) || code > 0x10ffff) {
+      throw exc::Validation("Unable to translate ansii to wide char string");
+    }
+    i += length;
+    if constexpr (sizeof(wchar_t) == sizeof(uint16_t)) {
+      if (code >= 0x10000) {
+        code -= 0x10000;
+        out[size++] = static_cast<wchar_t>(0xd800 + (code >> 10));
+        code = 0xdc00 + (code & 0x3ff);
+      }
+    }
+    out[size++] = static_cast<wchar_t>(code);
+  }
+  wide->resize(size);
+}
+
+bool iequals(std::wstring_view wide, std::string_view ansii) {
+  if (wide.size() != ansii.size()) return false;
+  for (size_t i = 0; i < wide.size(); ++i) {
+    auto w = static_cast<uint32_t>(wide[i]);
+    uint32_t a = static_cast<uint8_t>(ansii[i]);
+    // Non-ASCII chars are compared as is
+    if (w >= 'A' && w <= 'Z') w |= 0x20;
+    if (a >= 'A' && a <= 'Z') a |= 0x20;
+    if (w != a) return false;
+  }
+  return true;
+}
 }  // namespace windep::utils
@@ -1,15 +1,30 @@
 // copyright MIT License Copyright (c) 2021, Albert Farrakhov
 
 #pragma once
+#include <cstdint>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 namespace windep::utils {
+// ASCII only case folding, which is enough for the DLL names
 std::string lower(std::string text);
+void lower_inplace(std::string* text);
 bool startswith(const std::string& text, const std::string& prefix);
-std::string w2a(const std::wstring& wide);
-std::wstring a2w(const std::string& ansii);
+bool istartswith(std::string_view text, std::string_view prefix);
+bool iequals(std::string_view l, std::string_view r);
+uint64_t hash(std::string_view text);
+// Equals to hash(lower(text)) without creating the lowered copy
+uint64_t ihash(std::string_view text);
+// UTF-16 (UTF-32 where wchar_t is 4 bytes) <-> UTF-8 conversions with the
+// ASCII fast path. Overloads with the output argument reuse its buffer.
+std::string w2a(std::wstring_view wide);
+void w2a(std::wstring_view wide, std::string* ansii);
+std::wstring a2w(std::string_view ansii);
+void a2w(std::string_view ansii, std::wstring* wide);
+// ASCII case insensitive comparison of the wide and narrow strings
+bool iequals(std::wstring_view wide, std::string_view ansii);
 template <typename T>
 std::string hex(T i) {
   std::stringstream stream;
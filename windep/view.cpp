@@ -2,7 +2,14 @@
 
 #include "view.h"
 
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "exceptions.h"
+#include "graph.h"
 #include "json/json.hpp"
 #include "utils.h"
 
@@ -13,46 +20,301 @@ std::shared_ptr<View> Factory::Create(bool functions, uint8_t indent) {
     return std::make_shared<AsciiView>(functions, indent);
   } else if (format_ == "json") {
     return std::make_shared<JsonView>(functions, indent);
+  } else if (format_ == "ndjson") {
+    return std::make_shared<NdjsonView>(functions);
   } else if (format_ == "dot") {
     return std::make_shared<DotView>(indent);
   } else if (format_ == "csv") {
     return std::make_shared<CsvView>();
+  } else if (format_ == "edges") {
+    return std::make_shared<EdgeListView>();
+  } else if (format_ == "edges-ids") {
+    return std::make_shared<EdgeListView>(image::EdgeColumns::kIds);
+  } else if (format_ == "edges-names") {
+    return std::make_shared<EdgeListView>(image::EdgeColumns::kTables);
+  } else if (format_ == "scc") {
+    return std::make_shared<SccView>();
+  } else if (format_ == "load-order") {
+    return std::make_shared<LoadOrderView>();
+  } else if (format_ == "dominators") {
+    return std::make_shared<DominatorView>(indent);
   }
   throw exc::NotFound("Unsupported format");
 }
 
-void AsciiView::Show(std::shared_ptr<Dependency<image::Image>> root,
-                     std::shared_ptr<writer::Writer> writer) {
-  auto visitor =
+namespace {
+// Forwards every visited node to the visitors of many views
+class FanOutVisitor : public TreeVisitor<image::Image> {
+  std::vector<std::shared_ptr<TreeVisitor<image::Image>>> visitors_;
+
+ public:
+  void Add(std::shared_ptr<TreeVisitor<image::Image>> visitor) {
+    visitors_.push_back(std::move(visitor));
+  }
+  bool Empty() const { return visitors_.empty(); }
+  void Visit(std::shared_ptr<Dependency<image::Image>> node,
+             size_t height) override {
+    for (const auto& visitor : visitors_) visitor->Visit(node, height);
+  }
+};
+
+void Traverse(Traversal order, std::shared_ptr<Dependency<image::Image>> root,
+              std::shared_ptr<TreeVisitor<image::Image>> visitor) {
+  if (order == Traversal::kDfs) {
+    Dfs<image::Image> dfs{DfsDirection::kToLeaf};
+    dfs.Traverse(root, visitor);
+  } else {
+    Bfs<image::Image> bfs;
+    bfs.Traverse(root, visitor);
+  }
+}
+}  // namespace
+
+void View::Show(std::shared_ptr<Dependency<image::Image>> root,
+                std::shared_ptr<writer::Writer> writer) {
+  if (Order() == Traversal::kIndexed) {
+    ShowIndexed(graph::IndexedGraph<image::Image>{root}, writer);
+    return;
+  }
+  Traverse(Order(), root, Visitor(writer));
+  Finish(root, writer);
+}
+
+std::shared_ptr<TreeVisitor<image::Image>> View::Visitor(
+    std::shared_ptr<writer::Writer> writer) {
+  return nullptr;
+}
+
+void View::Finish(std::shared_ptr<Dependency<image::Image>> root,
+                  std::shared_ptr<writer::Writer> writer) {}
+
+std::shared_ptr<TreeVisitor<image::Image>> View::StreamVisitor(
+    std::shared_ptr<writer::Writer> writer) {
+  return nullptr;
+}
+
+void View::ShowIndexed(const graph::IndexedGraph<image::Image>& indexed,
+                       std::shared_ptr<writer::Writer> writer) {}
+
+void FanOut::Add(std::shared_ptr<View> view,
+                 std::shared_ptr<writer::Writer> writer) {
+  outputs_.emplace_back(std::move(view), std::move(writer));
+}
+
+void FanOut::Show(std::shared_ptr<Dependency<image::Image>> root) {
+  for (auto order : {Traversal::kDfs, Traversal::kBfs}) {
+    auto visitor = std::make_shared<FanOutVisitor>();
+    for (const auto& [view, writer] : outputs_) {
+      if (view->Order() == order) visitor->Add(view->Visitor(writer));
+    }
+    if (visitor->Empty()) continue;
+    Traverse(order, root, visitor);
+    for (const auto& [view, writer] : outputs_) {
+      if (view->Order() == order) view->Finish(root, writer);
+    }
+  }
+  std::unique_ptr<graph::IndexedGraph<image::Image>> indexed;
+  for (const auto& [view, writer] : outputs_) {
+    if (view->Order() != Traversal::kIndexed) continue;
+    if (!indexed) {
+      indexed = std::make_unique<graph::IndexedGraph<image::Image>>(root);
+    }
+    view->ShowIndexed(*indexed, writer);
+  }
+}
+
+std::shared_ptr<TreeVisitor<image::Image>> FanOut::Stream() {
+  auto visitor = std::make_shared<FanOutVisitor>();
+  for (const auto& [view, writer] : outputs_) {
+    auto stream_visitor = view->StreamVisitor(writer);
+    if (!stream_visitor) {
+      throw exc::Validation(
+          "Only csv, ndjson, dot and edges outputs can be streamed");
+    }
+    visitor->Add(std::move(stream_visitor));
+  }
+  return visitor;
+}
+
+void FanOut::Finish(std::shared_ptr<Dependency<image::Image>> root) {
+  for (const auto& [view, writer] : outputs_) view->Finish(root, writer);
+}
+
+Traversal AsciiView::Order() const { return Traversal::kDfs; }
+
+std::shared_ptr<TreeVisitor<image::Image>> AsciiView::Visitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ =
       std::make_shared<image::AsciiTreeVisitor>(writer, functions_, indent_);
-  Dfs<decltype(root)::element_type::Context> dfs{DfsDirection::kToLeaf};
-  dfs.Traverse(root, visitor);
+  return visitor_;
 }
 
-void JsonView::Show(std::shared_ptr<Dependency<image::Image>> root,
-                    std::shared_ptr<writer::Writer> writer) {
-  auto visitor = std::make_shared<image::JsonTreeVisitor>(functions_);
-  Bfs<decltype(root)::element_type::Context> bfs;
-  bfs.Traverse(root, visitor);
+void AsciiView::Finish(std::shared_ptr<Dependency<image::Image>> root,
+                       std::shared_ptr<writer::Writer> writer) {
+  visitor_->Finish();
+  visitor_.reset();
+}
+
+Traversal JsonView::Order() const { return Traversal::kBfs; }
+
+std::shared_ptr<TreeVisitor<image::Image>> JsonView::Visitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::JsonTreeVisitor>(functions_);
+  return visitor_;
+}
+
+void JsonView::Finish(std::shared_ptr<Dependency<image::Image>> root,
+                      std::shared_ptr<writer::Writer> writer) {
   auto root_name = root->GetContext()->Name();
   json root_json = {{root_name, json::object()}};
-  root_json[root_name]["imports"] = visitor->Json();
+  root_json[root_name]["imports"] = std::move(visitor_->Json());
+  visitor_.reset();
   writer->Write(root_json.dump(indent_ ? indent_ : -1) + '\n');
 }
 
-void DotView::Show(std::shared_ptr<Dependency<image::Image>> root,
-                   std::shared_ptr<writer::Writer> writer) {
-  auto visitor = std::make_shared<image::DotTreeVisitor>(indent_);
-  Bfs<decltype(root)::element_type::Context> bfs;
-  bfs.Traverse(root, visitor);
-  writer->Write(visitor->Dot());
+Traversal NdjsonView::Order() const { return Traversal::kBfs; }
+
+std::shared_ptr<TreeVisitor<image::Image>> NdjsonView::Visitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::NdjsonTreeVisitor>(writer, functions_);
+  return visitor_;
+}
+
+void NdjsonView::Finish(std::shared_ptr<Dependency<image::Image>> root,
+                        std::shared_ptr<writer::Writer> writer) {
+  visitor_->Finish();
+  visitor_.reset();
+}
+
+std::shared_ptr<TreeVisitor<image::Image>> NdjsonView::StreamVisitor(
+    std::shared_ptr<writer::Writer> writer) {
+  // Lines are written as soon as they are visited anyway
+  return Visitor(writer);
+}
+
+Traversal DotView::Order() const { return Traversal::kBfs; }
+
+std::shared_ptr<TreeVisitor<image::Image>> DotView::Visitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::DotTreeVisitor>(writer, indent_);
+  return visitor_;
+}
+
+void DotView::Finish(std::shared_ptr<Dependency<image::Image>> root,
+                     std::shared_ptr<writer::Writer> writer) {
+  visitor_->Finish();
+  visitor_.reset();
+}
+
+std::shared_ptr<TreeVisitor<image::Image>> DotView::StreamVisitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::DotTreeVisitor>(writer, indent_, 1);
+  return visitor_;
+}
+
+Traversal CsvView::Order() const { return Traversal::kBfs; }
+
+std::shared_ptr<TreeVisitor<image::Image>> CsvView::Visitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::CsvTreeVisitor>(writer);
+  return visitor_;
+}
+
+void CsvView::Finish(std::shared_ptr<Dependency<image::Image>> root,
+                     std::shared_ptr<writer::Writer> writer) {
+  visitor_->Finish();
+  visitor_.reset();
+}
+
+std::shared_ptr<TreeVisitor<image::Image>> CsvView::StreamVisitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::CsvTreeVisitor>(writer, 1);
+  return visitor_;
 }
 
-void CsvView::Show(std::shared_ptr<Dependency<image::Image>> root,
-                   std::shared_ptr<writer::Writer> writer) {
-  auto visitor = std::make_shared<image::CsvTreeVisitor>();
-  Bfs<decltype(root)::element_type::Context> bfs;
-  bfs.Traverse(root, visitor);
-  writer->Write(visitor->Csv());
+Traversal EdgeListView::Order() const { return Traversal::kBfs; }
+
+std::shared_ptr<TreeVisitor<image::Image>> EdgeListView::Visitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::EdgeListTreeVisitor>(writer, columns_);
+  return visitor_;
+}
+
+void EdgeListView::Finish(std::shared_ptr<Dependency<image::Image>> root,
+                          std::shared_ptr<writer::Writer> writer) {
+  visitor_->Finish();
+  visitor_.reset();
+}
+
+std::shared_ptr<TreeVisitor<image::Image>> EdgeListView::StreamVisitor(
+    std::shared_ptr<writer::Writer> writer) {
+  visitor_ = std::make_shared<image::EdgeListTreeVisitor>(writer, columns_, 1);
+  return visitor_;
+}
+
+Traversal SccView::Order() const { return Traversal::kIndexed; }
+
+void SccView::ShowIndexed(const graph::IndexedGraph<image::Image>& indexed,
+                          std::shared_ptr<writer::Writer> writer) {
+  const auto components = graph::StronglyConnected(indexed.Edges());
+  std::stringstream output;
+  for (size_t id = 0; id < components.members.size(); ++id) {
+    output << '[' << id << ']';
+    for (const auto node : components.members[id]) {
+      output << ' ' << indexed.Node(node)->GetContext()->Name();
+    }
+    const auto& dag = components.dag;
+    if (dag.Begin(id) != dag.End(id)) output << " ->";
+    for (auto it = dag.Begin(id); it != dag.End(id); ++it) {
+      output << " [" << *it << ']';
+    }
+    output << '\n';
+  }
+  writer->Write(output);
+}
+
+Traversal DominatorView::Order() const { return Traversal::kIndexed; }
+
+void DominatorView::ShowIndexed(
+    const graph::IndexedGraph<image::Image>& indexed,
+    std::shared_ptr<writer::Writer> writer) {
+  const auto idoms = graph::ImmediateDominators(indexed.Edges());
+  // Edges from the nodes to their immediate dominators, reversed to the tree
+  graph::Adjacency dominated;
+  for (size_t node = 0; node < idoms.size(); ++node) {
+    if (idoms[node] != graph::kNoNode && idoms[node] != node) {
+      dominated.targets.push_back(idoms[node]);
+    }
+    dominated.offsets.push_back(dominated.targets.size());
+  }
+  const auto children = graph::Reverse(dominated);
+  std::stringstream output;
+  std::vector<std::pair<size_t, size_t>> stack{{0, 0}};
+  while (stack.size()) {
+    const auto [node, height] = stack.back();
+    stack.pop_back();
+    output << std::string(height * indent_, ' ')
+           << indexed.Node(node)->GetContext()->Name() << '\n';
+    for (auto it = children.End(node); it != children.Begin(node);) {
+      stack.emplace_back(*--it, height + 1);
+    }
+  }
+  writer->Write(output);
+}
+
+Traversal LoadOrderView::Order() const { return Traversal::kIndexed; }
+
+void LoadOrderView::ShowIndexed(
+    const graph::IndexedGraph<image::Image>& indexed,
+    std::shared_ptr<writer::Writer> writer) {
+  const auto components = graph::StronglyConnected(indexed.Edges());
+  const auto depths = graph::ComponentDepths(components);
+  std::stringstream output;
+  for (const auto node : graph::TopologicalOrder(components, depths)) {
+    const auto id = components.component[node];
+    output << indexed.Node(node)->GetContext()->Name()
+           << " depth=" << depths[id] << " scc=" << id << '\n';
+  }
+  writer->Write(output);
 }
 }  // namespace windep::view
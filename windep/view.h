@@ -3,17 +3,59 @@
 #pragma once
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "dependency.h"
+#include "graph.h"
 #include "image.h"
+#include "traversing.h"
 #include "utils.h"
 #include "writer.h"
 
 namespace windep::view {
+// Pass over the graph, which feeds the view. Views with the same traversal
+// share one pass, when they are shown together by the FanOut.
+enum class Traversal : uint8_t { kDfs, kBfs, kIndexed };
+
 class View {
  public:
-  virtual void Show(std::shared_ptr<Dependency<image::Image>>,
-                    std::shared_ptr<writer::Writer>) = 0;
+  virtual ~View() = default;
+  virtual Traversal Order() const = 0;
+  // Runs the own traversal of the view
+  virtual void Show(std::shared_ptr<Dependency<image::Image>> root,
+                    std::shared_ptr<writer::Writer> writer);
+  // kDfs and kBfs views: visitor is fed by the traversal, then Finish writes
+  // the collected output
+  virtual std::shared_ptr<TreeVisitor<image::Image>> Visitor(
+      std::shared_ptr<writer::Writer> writer);
+  virtual void Finish(std::shared_ptr<Dependency<image::Image>> root,
+                      std::shared_ptr<writer::Writer> writer);
+  // Streaming views: visitor, which writes every node as soon as it is
+  // visited in any order, e.g. by the pipeline, then Finish writes the rest.
+  // Null for the views, which depend on the traversal order.
+  virtual std::shared_ptr<TreeVisitor<image::Image>> StreamVisitor(
+      std::shared_ptr<writer::Writer> writer);
+  // kIndexed views
+  virtual void ShowIndexed(const graph::IndexedGraph<image::Image>& indexed,
+                           std::shared_ptr<writer::Writer> writer);
+};
+
+// Many views of one graph, e.g. json for the tools and dot for the humans.
+// All views are fed by a single pass per traversal order, so the indexed
+// views share one IndexedGraph too.
+class FanOut {
+  std::vector<
+      std::pair<std::shared_ptr<View>, std::shared_ptr<writer::Writer>>>
+      outputs_;
+
+ public:
+  void Add(std::shared_ptr<View> view, std::shared_ptr<writer::Writer> writer);
+  void Show(std::shared_ptr<Dependency<image::Image>> root);
+  // Visitor of all views for the nodes produced outside of a traversal, the
+  // views must be streaming. Finish is called after the last node.
+  std::shared_ptr<TreeVisitor<image::Image>> Stream();
+  void Finish(std::shared_ptr<Dependency<image::Image>> root);
 };
 
 class Factory {
@@ -27,37 +69,123 @@ class Factory {
 class AsciiView : public View {
   bool functions_;
   uint8_t indent_;
+  std::shared_ptr<image::AsciiTreeVisitor> visitor_;
 
  public:
   explicit AsciiView(bool functions, uint8_t indent)
       : functions_(functions), indent_(indent) {}
-  void Show(std::shared_ptr<Dependency<image::Image>>,
-            std::shared_ptr<writer::Writer>) override;
+  Traversal Order() const override;
+  std::shared_ptr<TreeVisitor<image::Image>> Visitor(
+      std::shared_ptr<writer::Writer> writer) override;
+  void Finish(std::shared_ptr<Dependency<image::Image>> root,
+              std::shared_ptr<writer::Writer> writer) override;
 };
 
 class JsonView : public View {
   bool functions_;
   uint8_t indent_;
+  std::shared_ptr<image::JsonTreeVisitor> visitor_;
 
  public:
   explicit JsonView(bool functions, uint8_t indent)
       : functions_(functions), indent_(indent) {}
-  void Show(std::shared_ptr<Dependency<image::Image>>,
-            std::shared_ptr<writer::Writer>) override;
+  Traversal Order() const override;
+  std::shared_ptr<TreeVisitor<image::Image>> Visitor(
+      std::shared_ptr<writer::Writer> writer) override;
+  void Finish(std::shared_ptr<Dependency<image::Image>> root,
+              std::shared_ptr<writer::Writer> writer) override;
+};
+
+// One JSON line per node, written as the traversal reaches it
+class NdjsonView : public View {
+  bool functions_;
+  std::shared_ptr<image::NdjsonTreeVisitor> visitor_;
+
+ public:
+  explicit NdjsonView(bool functions) : functions_(functions) {}
+  Traversal Order() const override;
+  std::shared_ptr<TreeVisitor<image::Image>> Visitor(
+      std::shared_ptr<writer::Writer> writer) override;
+  void Finish(std::shared_ptr<Dependency<image::Image>> root,
+              std::shared_ptr<writer::Writer> writer) override;
+  std::shared_ptr<TreeVisitor<image::Image>> StreamVisitor(
+      std::shared_ptr<writer::Writer> writer) override;
 };
 
 class DotView : public View {
   uint8_t indent_;
+  std::shared_ptr<image::DotTreeVisitor> visitor_;
 
  public:
   explicit DotView(uint8_t indent = 2) : indent_(indent) {}
-  void Show(std::shared_ptr<Dependency<image::Image>>,
-            std::shared_ptr<writer::Writer>) override;
+  Traversal Order() const override;
+  std::shared_ptr<TreeVisitor<image::Image>> Visitor(
+      std::shared_ptr<writer::Writer> writer) override;
+  void Finish(std::shared_ptr<Dependency<image::Image>> root,
+              std::shared_ptr<writer::Writer> writer) override;
+  std::shared_ptr<TreeVisitor<image::Image>> StreamVisitor(
+      std::shared_ptr<writer::Writer> writer) override;
 };
 
 class CsvView : public View {
+  std::shared_ptr<image::CsvTreeVisitor> visitor_;
+
+ public:
+  Traversal Order() const override;
+  std::shared_ptr<TreeVisitor<image::Image>> Visitor(
+      std::shared_ptr<writer::Writer> writer) override;
+  void Finish(std::shared_ptr<Dependency<image::Image>> root,
+              std::shared_ptr<writer::Writer> writer) override;
+  std::shared_ptr<TreeVisitor<image::Image>> StreamVisitor(
+      std::shared_ptr<writer::Writer> writer) override;
+};
+
+// One row per imported function, see EdgeListTreeVisitor
+class EdgeListView : public View {
+  image::EdgeColumns columns_;
+  std::shared_ptr<image::EdgeListTreeVisitor> visitor_;
+
+ public:
+  explicit EdgeListView(
+      image::EdgeColumns columns = image::EdgeColumns::kNames)
+      : columns_(columns) {}
+  Traversal Order() const override;
+  std::shared_ptr<TreeVisitor<image::Image>> Visitor(
+      std::shared_ptr<writer::Writer> writer) override;
+  void Finish(std::shared_ptr<Dependency<image::Image>> root,
+              std::shared_ptr<writer::Writer> writer) override;
+  std::shared_ptr<TreeVisitor<image::Image>> StreamVisitor(
+      std::shared_ptr<writer::Writer> writer) override;
+};
+
+// Strongly connected components, one per line with the components they
+// import: "[2] kernel32.dll kernelbase.dll -> [0] [1]". Components are
+// numbered from the leaves, so every line refers only to the previous ones.
+class SccView : public View {
+ public:
+  Traversal Order() const override;
+  void ShowIndexed(const graph::IndexedGraph<image::Image>& indexed,
+                   std::shared_ptr<writer::Writer> writer) override;
+};
+
+// Dominator tree: every module is placed under the closest module, which is
+// on every import chain from the root to it
+class DominatorView : public View {
+  uint8_t indent_;
+
+ public:
+  explicit DominatorView(uint8_t indent = 2) : indent_(indent) {}
+  Traversal Order() const override;
+  void ShowIndexed(const graph::IndexedGraph<image::Image>& indexed,
+                   std::shared_ptr<writer::Writer> writer) override;
+};
+
+// Order of the modules initialization, leaves first, each module once:
+// "kernelbase.dll depth=1 scc=1"
+class LoadOrderView : public View {
  public:
-  void Show(std::shared_ptr<Dependency<image::Image>>,
-            std::shared_ptr<writer::Writer>) override;
+  Traversal Order() const override;
+  void ShowIndexed(const graph::IndexedGraph<image::Image>& indexed,
+                   std::shared_ptr<writer::Writer> writer) override;
 };
 }  // namespace windep::view
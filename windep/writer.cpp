@@ -10,6 +10,13 @@ void StreamWriter::Write(const std::string& str) { *stream_ << str; }
 void StreamWriter::Write(const std::stringstream& str_stream) {
   *stream_ << str_stream.str();
 }
+void StreamWriter::Flush() { stream_->flush(); }
+
+void StringWriter::Write(const std::string& str) { output_ += str; }
+void StringWriter::Write(const std::stringstream& str_stream) {
+  output_ += str_stream.str();
+}
+const std::string& StringWriter::String() const { return output_; }
 
 std::shared_ptr<Writer> StreamFactory::Create(const std::wstring& path) {
   if (path.empty()) {
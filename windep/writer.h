@@ -12,6 +12,8 @@ class Writer {
  public:
   virtual void Write(const std::string&) = 0;
   virtual void Write(const std::stringstream&) = 0;
+  // Hands the written output to the consumer, e.g. the reading pipe
+  virtual void Flush() {}
 };
 
 class StreamWriter : public Writer {
@@ -22,6 +24,17 @@ class StreamWriter : public Writer {
       : stream_(stream) {}
   void Write(const std::string&) override;
   void Write(const std::stringstream&) override;
+  void Flush() override;
+};
+
+// Collects the output in memory, e.g. to send it as a single response
+class StringWriter : public Writer {
+  std::string output_;
+
+ public:
+  void Write(const std::string&) override;
+  void Write(const std::stringstream&) override;
+  const std::string& String() const;
 };
 
 class WriterFactory {